@@ -0,0 +1,204 @@
+// The C interface of lowrank.h on top of lib/png and lib/matrix
+
+#include "lowrank.h"
+#include "../matrix/svd.h"
+#include "../png/readpng.h"
+#include "../png/savepng.h"
+#include <stdlib.h>
+#include <string.h>
+
+int lr_abi_version(void) { return LR_ABI_VERSION; }
+
+void *lr_alloc(size_t bytes) { return malloc(bytes ? bytes : 1); }
+
+void lr_free(void *p) { free(p); }
+
+// Decoded rows go straight into the caller's array, as double or float
+struct read_ctx {
+  const int *ihdr;
+  double *d;
+  float *f;
+  int as_float;
+};
+
+static void read_row(int y, const int *row, void *ctx) {
+  struct read_ctx *c = ctx;
+  int w = c->ihdr[0];
+  size_t size = (size_t)c->ihdr[1] * w;
+  if (c->as_float) {
+    if (c->f == NULL)
+      c->f = (float *)lr_alloc(size * sizeof(float));
+    for (int j = 0; j < w; j++)
+      c->f[(size_t)y * w + j] = (float)row[j];
+  } else {
+    if (c->d == NULL)
+      c->d = (double *)lr_alloc(size * sizeof(double));
+    for (int j = 0; j < w; j++)
+      c->d[(size_t)y * w + j] = (double)row[j];
+  }
+}
+
+static int read_png(const char *path, int *width, int *height, int *bit_depth,
+                    struct read_ctx *c) {
+  int ihdr[7];
+  c->ihdr = ihdr;
+  if (!path || readpng_stream(path, ihdr, read_row, c, 0) != 0) {
+    lr_free(c->d);
+    lr_free(c->f);
+    return -1;
+  }
+  if (width)
+    *width = ihdr[0];
+  if (height)
+    *height = ihdr[1];
+  if (bit_depth)
+    *bit_depth = ihdr[2];
+  return 0;
+}
+
+double *lr_png_read(const char *path, int *width, int *height,
+                    int *bit_depth) {
+  struct read_ctx c = {NULL, NULL, NULL, 0};
+  return read_png(path, width, height, bit_depth, &c) == 0 ? c.d : NULL;
+}
+
+float *lr_png_read_f(const char *path, int *width, int *height,
+                     int *bit_depth) {
+  struct read_ctx c = {NULL, NULL, NULL, 1};
+  return read_png(path, width, height, bit_depth, &c) == 0 ? c.f : NULL;
+}
+
+struct write_ctx {
+  int width;
+  const double *d;
+  const float *f;
+};
+
+static void write_row(int y, double *row, void *ctx) {
+  struct write_ctx *c = ctx;
+  for (int j = 0; j < c->width; j++)
+    row[j] = c->d ? c->d[(size_t)y * c->width + j]
+                  : (double)c->f[(size_t)y * c->width + j];
+}
+
+static int write_png(const char *path, int width, int height, int bit_depth,
+                     struct write_ctx *c) {
+  int ihdr[7] = {width, height, 8, 0, 0, 0, 0};
+  if (!path || width <= 0 || height <= 0 || (!c->d && !c->f))
+    return -1;
+  return savepng_rows_from(path, bit_depth, ihdr, write_row, c, 0);
+}
+
+int lr_png_write(const char *path, int width, int height, int bit_depth,
+                 const double *pixels) {
+  struct write_ctx c = {width, pixels, NULL};
+  return write_png(path, width, height, bit_depth, &c);
+}
+
+int lr_png_write_f(const char *path, int width, int height, int bit_depth,
+                   const float *pixels) {
+  struct write_ctx c = {width, NULL, pixels};
+  return write_png(path, width, height, bit_depth, &c);
+}
+
+// Factor the rows A (m x n) and copy the factors out as contiguous arrays of
+// double (ud, sd, vd) or float (uf, sf, vf)
+static int factor(int m, int n, double **A, int k, double grey, double **ud,
+                  double **sd, double **vd, float **uf, float **sf,
+                  float **vf) {
+  thin_svd *f = svd_thin(m, n, A, k, grey, NULL);
+  if (!f)
+    return -1;
+  int r = f->r;
+  if (ud) {
+    *ud = (double *)lr_alloc((size_t)m * r * sizeof(double));
+    *sd = (double *)lr_alloc((size_t)r * sizeof(double));
+    *vd = (double *)lr_alloc((size_t)n * r * sizeof(double));
+    memcpy(*sd, f->S, r * sizeof(double));
+    for (int i = 0; i < m; i++)
+      memcpy(*ud + (size_t)i * r, f->U[i], r * sizeof(double));
+    for (int j = 0; j < n; j++)
+      memcpy(*vd + (size_t)j * r, f->V[j], r * sizeof(double));
+  } else {
+    *uf = (float *)lr_alloc((size_t)m * r * sizeof(float));
+    *sf = (float *)lr_alloc((size_t)r * sizeof(float));
+    *vf = (float *)lr_alloc((size_t)n * r * sizeof(float));
+    for (int t = 0; t < r; t++)
+      (*sf)[t] = (float)f->S[t];
+    for (int i = 0; i < m; i++)
+      for (int t = 0; t < r; t++)
+        (*uf)[(size_t)i * r + t] = (float)f->U[i][t];
+    for (int j = 0; j < n; j++)
+      for (int t = 0; t < r; t++)
+        (*vf)[(size_t)j * r + t] = (float)f->V[j][t];
+  }
+  free_thin_svd(f);
+  return r;
+}
+
+int lr_svd(int m, int n, const double *a, int k, double grey, double **u,
+           double **s, double **v) {
+  if (m <= 0 || n <= 0 || !a || !u || !s || !v)
+    return -1;
+  // the solvers only read A, so its rows can point into the caller's array
+  double **A = (double **)malloc(m * sizeof(double *));
+  for (int i = 0; i < m; i++)
+    A[i] = (double *)(a + (size_t)i * n);
+  int r = factor(m, n, A, k, grey, u, s, v, NULL, NULL, NULL);
+  free(A);
+  return r;
+}
+
+int lr_svd_f(int m, int n, const float *a, int k, double grey, float **u,
+             float **s, float **v) {
+  if (m <= 0 || n <= 0 || !a || !u || !s || !v)
+    return -1;
+  // the solvers work in double
+  double **A = (double **)malloc(m * sizeof(double *));
+  for (int i = 0; i < m; i++) {
+    A[i] = (double *)malloc(n * sizeof(double));
+    for (int j = 0; j < n; j++)
+      A[i][j] = a[(size_t)i * n + j];
+  }
+  int r = factor(m, n, A, k, grey, NULL, NULL, NULL, u, s, v);
+  for (int i = 0; i < m; i++)
+    free(A[i]);
+  free(A);
+  return r;
+}
+
+int lr_reconstruct(int m, int n, int r, const double *u, const double *s,
+                   const double *v, int k, double *out) {
+  if (m <= 0 || n <= 0 || r < 0 || !u || !s || !v || !out)
+    return -1;
+  if (k > r || k <= 0)
+    k = r;
+  memset(out, 0, (size_t)m * n * sizeof(double));
+  for (int i = 0; i < m; i++)
+    for (int t = 0; t < k; t++) {
+      double coeff = s[t] * u[(size_t)i * r + t];
+      if (coeff == 0.0)
+        continue;
+      for (int j = 0; j < n; j++)
+        out[(size_t)i * n + j] += coeff * v[(size_t)j * r + t];
+    }
+  return 0;
+}
+
+int lr_reconstruct_f(int m, int n, int r, const float *u, const float *s,
+                     const float *v, int k, float *out) {
+  if (m <= 0 || n <= 0 || r < 0 || !u || !s || !v || !out)
+    return -1;
+  if (k > r || k <= 0)
+    k = r;
+  memset(out, 0, (size_t)m * n * sizeof(float));
+  for (int i = 0; i < m; i++)
+    for (int t = 0; t < k; t++) {
+      float coeff = s[t] * u[(size_t)i * r + t];
+      if (coeff == 0.0f)
+        continue;
+      for (int j = 0; j < n; j++)
+        out[(size_t)i * n + j] += coeff * v[(size_t)j * r + t];
+    }
+  return 0;
+}
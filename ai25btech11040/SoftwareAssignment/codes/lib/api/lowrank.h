@@ -0,0 +1,73 @@
+#ifndef LOWRANK_H
+#define LOWRANK_H
+
+// Stable C interface to the decode / SVD / reconstruct / encode stages, for
+// use as liblowrank.a or liblowrank.so (see the README). Only plain types
+// cross the boundary: matrices are contiguous row-major arrays with their
+// sizes passed alongside. Arrays returned by the library are owned by the
+// caller and must be released with lr_free(). Functions returning int give
+// -1 on failure.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Everything else in the library is built with -fvisibility=hidden
+#if defined(__GNUC__)
+#define LR_API __attribute__((visibility("default")))
+#else
+#define LR_API
+#endif
+
+// Bumped whenever a function below changes; new functions may be added
+// without bumping it
+#define LR_ABI_VERSION 1
+
+LR_API int lr_abi_version(void);
+
+LR_API void *lr_alloc(size_t bytes);
+
+LR_API void lr_free(void *p);
+
+// Decode a greyscale PNG into a height x width array of pixel values
+LR_API double *lr_png_read(const char *path, int *width, int *height,
+                           int *bit_depth);
+
+LR_API float *lr_png_read_f(const char *path, int *width, int *height,
+                            int *bit_depth);
+
+// Encode a height x width array as an 8-bit PNG. The values are at bit_depth
+// (1 to 16), as lr_png_read() returns them: 0..2^bit_depth - 1 is rescaled
+// to 0..255, and anything outside it is clamped. Returns -1 for another depth.
+LR_API int lr_png_write(const char *path, int width, int height,
+                        int bit_depth, const double *pixels);
+
+LR_API int lr_png_write_f(const char *path, int width, int height,
+                          int bit_depth, const float *pixels);
+
+// Economy SVD of the m x n array a, keeping at most k triplets (all of them
+// if k <= 0). On success *u (m x r), *s (r) and *v (n x r) are set to new
+// arrays and r is returned. grey is the accuracy target in grey levels, 0 for
+// the strict default.
+LR_API int lr_svd(int m, int n, const double *a, int k, double grey,
+                  double **u, double **s, double **v);
+
+LR_API int lr_svd_f(int m, int n, const float *a, int k, double grey,
+                    float **u, float **s, float **v);
+
+// out (m x n, allocated by the caller) = sum of the first k triplets of a
+// rank r factorization
+LR_API int lr_reconstruct(int m, int n, int r, const double *u,
+                          const double *s, const double *v, int k,
+                          double *out);
+
+LR_API int lr_reconstruct_f(int m, int n, int r, const float *u,
+                            const float *s, const float *v, int k, float *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOWRANK_H
@@ -0,0 +1,200 @@
+#ifndef LOWRANK_HPP
+#define LOWRANK_HPP
+
+// Header-only C++ layer over lowrank.h. Matrix, Svd and Image own their
+// arrays and are move-only, so each stage hands its result to the next one
+// without copying it. T is float or double. Failures throw
+// std::runtime_error.
+
+#include "lowrank.h"
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace lowrank {
+
+namespace detail {
+
+inline double *png_read(const char *path, int *w, int *h, int *bd, double *) {
+  return lr_png_read(path, w, h, bd);
+}
+inline float *png_read(const char *path, int *w, int *h, int *bd, float *) {
+  return lr_png_read_f(path, w, h, bd);
+}
+
+inline int png_write(const char *path, int w, int h, int bd, const double *p) {
+  return lr_png_write(path, w, h, bd, p);
+}
+inline int png_write(const char *path, int w, int h, int bd, const float *p) {
+  return lr_png_write_f(path, w, h, bd, p);
+}
+
+inline int svd(int m, int n, const double *a, int k, double grey, double **u,
+               double **s, double **v) {
+  return lr_svd(m, n, a, k, grey, u, s, v);
+}
+inline int svd(int m, int n, const float *a, int k, double grey, float **u,
+               float **s, float **v) {
+  return lr_svd_f(m, n, a, k, grey, u, s, v);
+}
+
+inline int reconstruct(int m, int n, int r, const double *u, const double *s,
+                       const double *v, int k, double *out) {
+  return lr_reconstruct(m, n, r, u, s, v, k, out);
+}
+inline int reconstruct(int m, int n, int r, const float *u, const float *s,
+                       const float *v, int k, float *out) {
+  return lr_reconstruct_f(m, n, r, u, s, v, k, out);
+}
+
+} // namespace detail
+
+// rows x cols, row-major, allocated with lr_alloc()
+template <typename T> class Matrix {
+  static_assert(std::is_same<T, float>::value ||
+                    std::is_same<T, double>::value,
+                "Matrix<T> supports float and double");
+
+public:
+  Matrix() : data_(nullptr), rows_(0), cols_(0) {}
+
+  // Zero-filled
+  Matrix(int rows, int cols) : data_(nullptr), rows_(rows), cols_(cols) {
+    data_ = static_cast<T *>(lr_alloc(size() * sizeof(T)));
+    if (!data_)
+      throw std::bad_alloc();
+    std::memset(data_, 0, size() * sizeof(T));
+  }
+
+  // Takes ownership of an array returned by the library
+  static Matrix adopt(T *data, int rows, int cols) {
+    Matrix m;
+    m.data_ = data;
+    m.rows_ = rows;
+    m.cols_ = cols;
+    return m;
+  }
+
+  Matrix(Matrix &&o) noexcept : data_(o.data_), rows_(o.rows_), cols_(o.cols_) {
+    o.data_ = nullptr;
+    o.rows_ = o.cols_ = 0;
+  }
+
+  Matrix &operator=(Matrix &&o) noexcept {
+    if (this != &o) {
+      lr_free(data_);
+      data_ = o.data_;
+      rows_ = o.rows_;
+      cols_ = o.cols_;
+      o.data_ = nullptr;
+      o.rows_ = o.cols_ = 0;
+    }
+    return *this;
+  }
+
+  Matrix(const Matrix &) = delete;
+  Matrix &operator=(const Matrix &) = delete;
+
+  ~Matrix() { lr_free(data_); }
+
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  std::size_t size() const { return (std::size_t)rows_ * cols_; }
+  T *data() { return data_; }
+  const T *data() const { return data_; }
+
+  T &operator()(int i, int j) { return data_[(std::size_t)i * cols_ + j]; }
+  const T &operator()(int i, int j) const {
+    return data_[(std::size_t)i * cols_ + j];
+  }
+
+  // Gives up ownership, the caller must lr_free() the array
+  T *release() {
+    T *p = data_;
+    data_ = nullptr;
+    rows_ = cols_ = 0;
+    return p;
+  }
+
+private:
+  T *data_;
+  int rows_, cols_;
+};
+
+// Economy SVD, A ~ U diag(S) V^T with U (m x r), S (r x 1), V (n x r)
+template <typename T> class Svd {
+public:
+  explicit Svd(const Matrix<T> &a, int k = 0, double grey = 0.0) {
+    T *u = nullptr, *s = nullptr, *v = nullptr;
+    int r = detail::svd(a.rows(), a.cols(), a.data(), k, grey, &u, &s, &v);
+    if (r < 0)
+      throw std::runtime_error("lowrank: SVD failed");
+    u_ = Matrix<T>::adopt(u, a.rows(), r);
+    s_ = Matrix<T>::adopt(s, r, 1);
+    v_ = Matrix<T>::adopt(v, a.cols(), r);
+  }
+
+  Svd(Svd &&) = default;
+  Svd &operator=(Svd &&) = default;
+
+  int rank() const { return s_.rows(); }
+  const Matrix<T> &u() const { return u_; }
+  const Matrix<T> &s() const { return s_; }
+  const Matrix<T> &v() const { return v_; }
+
+  // A_k from the first k triplets (all of them if k <= 0)
+  Matrix<T> reconstruct(int k = 0) const {
+    Matrix<T> out(u_.rows(), v_.rows());
+    if (detail::reconstruct(u_.rows(), v_.rows(), rank(), u_.data(),
+                            s_.data(), v_.data(), k, out.data()) != 0)
+      throw std::runtime_error("lowrank: reconstruction failed");
+    return out;
+  }
+
+private:
+  Matrix<T> u_, s_, v_;
+};
+
+// A greyscale image, pixels as a height x width Matrix<T>
+template <typename T = double> class Image {
+public:
+  explicit Image(Matrix<T> &&pixels, int bit_depth = 8)
+      : pixels_(std::move(pixels)), bit_depth_(bit_depth) {}
+
+  static Image read(const std::string &path) {
+    int w, h, bd;
+    T *p = detail::png_read(path.c_str(), &w, &h, &bd, (T *)nullptr);
+    if (!p)
+      throw std::runtime_error("lowrank: cannot read " + path);
+    return Image(Matrix<T>::adopt(p, h, w), bd);
+  }
+
+  // Written as 8-bit greyscale, values rescaled from 0..2^bit_depth() - 1
+  // to 0..255 (and clamped)
+  void write(const std::string &path) const {
+    if (detail::png_write(path.c_str(), width(), height(), bit_depth_,
+                          pixels_.data()) != 0)
+      throw std::runtime_error("lowrank: cannot write " + path);
+  }
+
+  int width() const { return pixels_.cols(); }
+  int height() const { return pixels_.rows(); }
+  int bit_depth() const { return bit_depth_; }
+  Matrix<T> &pixels() { return pixels_; }
+  const Matrix<T> &pixels() const { return pixels_; }
+
+  // Hands the pixels on (e.g. to Svd) without copying, leaving this empty
+  Matrix<T> take_pixels() { return std::move(pixels_); }
+
+private:
+  Matrix<T> pixels_;
+  int bit_depth_;
+};
+
+} // namespace lowrank
+
+#endif // LOWRANK_HPP
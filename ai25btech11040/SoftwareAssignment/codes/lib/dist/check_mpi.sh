@@ -0,0 +1,55 @@
+#!/bin/sh
+# Reproduces the MPI table in report.md: runs --mpi on 1, 2, 4, ... processes
+# and checks that every out.png is byte-identical to the single-process
+# svd_thin() result. Run from codes/:
+#   sh lib/dist/check_mpi.sh <k> <image.png>... [-- <process counts>]
+# e.g. sh lib/dist/check_mpi.sh 20 ../figs/imgs/*.png -- 1 2 4 8
+# Each rank is bound to its own core. Counts above the number of cores are
+# still run (oversubscribed, unbound) for the identity check, but their
+# times say nothing about scaling and are marked as such.
+
+set -e
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 <k> <image.png>... [-- <process counts>]" >&2
+  exit 2
+fi
+k=$1
+shift
+images=""
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+  images="$images $1"
+  shift
+done
+[ "$1" = "--" ] && shift
+counts=${*:-"1 2 4"}
+cores=$(nproc)
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+gcc main.c lib/*/*.c -lm -lz -lpng -lpthread -O3 -o "$work/serial"
+mpicc -DUSE_MPI main.c lib/*/*.c -lm -lz -lpng -lpthread -O3 -o "$work/mpi"
+
+status=0
+for img in $images; do
+  src=$(cd "$(dirname "$img")" && pwd)/$(basename "$img")
+  (cd "$work" && ./serial "$src" "$k" >/dev/null && mv out.png ref.png)
+  for np in $counts; do
+    if [ "$np" -le "$cores" ]; then
+      flags="--bind-to core"
+      note=""
+    else
+      flags="--oversubscribe --bind-to none"
+      note=" (oversubscribed: $np processes on $cores cores)"
+    fi
+    line=$(cd "$work" && mpirun $flags -np "$np" ./mpi "$src" "$k" --mpi |
+      grep 'One-sided Jacobi')
+    if cmp -s "$work/out.png" "$work/ref.png"; then
+      same="identical"
+    else
+      same="DIFFERENT"
+      status=1
+    fi
+    echo "$(basename "$img") N=$np: $line, out.png $same$note"
+  done
+done
+exit $status
@@ -0,0 +1,355 @@
+// Distributed SVD by one-sided (Hestenes) Jacobi. The columns of A are split
+// into 2P blocks, two per process. In each step a process makes every column
+// of one of its blocks orthogonal to every column of the other (and, in the
+// first step of a sweep, the columns within each block), then the blocks move
+// on in round-robin order so that every pair of blocks meets once per sweep.
+// The columns converge to U Sigma, and the same rotations applied to the
+// identity give V.
+
+#include "mpisvd.h"
+#include <stdio.h>
+
+#ifdef USE_MPI
+
+#include "../matrix/helper.h"
+#include "../matrix/lra.h"
+#include "../png/readpng.h"
+#include "../png/savepng.h"
+#include <math.h>
+#include <mpi.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ONESIDED_TOL 1e-12     // |cos| below which two columns are orthogonal
+#define ONESIDED_MAX_SWEEPS 40
+#define ONESIDED_ZERO 1e-28    // columns with |x|^2 below this * ||A||^2 are
+                               // rounding noise and count as zero
+
+// Block at position pos in step s of the round robin over nb (even) blocks:
+// position 0 stays put and the others rotate by one place per step. Process
+// r works on positions r and nb - 1 - r, so the pairing repeats after nb - 1
+// steps.
+static int block_at(int nb, int s, int pos) {
+  if (pos == 0)
+    return 0;
+  return 1 + (pos - 1 + s) % (nb - 1);
+}
+
+static int owner(int nb, int s, int b) {
+  for (int pos = 0; pos < nb; pos++)
+    if (block_at(nb, s, pos) == b)
+      return (pos < nb - 1 - pos) ? pos : nb - 1 - pos;
+  return -1;
+}
+
+// First column of block b when nc columns are split into nb blocks
+static int block_lo(int nc, int nb, int b) {
+  return (int)((long)b * nc / nb);
+}
+
+static int block_of(int nc, int nb, int j) {
+  int b = 0;
+  while (block_lo(nc, nb, b + 1) <= j)
+    b++;
+  return b;
+}
+
+// Rotates the columns x and y (len entries of the matrix followed by w of V)
+// so that their first len entries become orthogonal. Returns |cos| of the
+// angle between them beforehand. Columns with a squared norm at most `zero`
+// are left alone: in a rank deficient matrix they end up as pure rounding
+// error, which never looks orthogonal to anything.
+static double rotate(double *x, double *y, int len, int w, double zero) {
+  double a = 0.0, b = 0.0, g = 0.0;
+  for (int i = 0; i < len; i++) {
+    a += x[i] * x[i];
+    b += y[i] * y[i];
+    g += x[i] * y[i];
+  }
+  if (a <= zero || b <= zero)
+    return 0.0;
+  double c = fabs(g) / sqrt(a * b);
+  if (c < ONESIDED_TOL)
+    return c;
+  double zeta = (b - a) / (2.0 * g);
+  double t =
+      ((zeta >= 0) ? 1.0 : -1.0) / (fabs(zeta) + sqrt(1.0 + zeta * zeta));
+  double cs = 1.0 / sqrt(1.0 + t * t), sn = cs * t;
+  for (int i = 0; i < len + w; i++) {
+    double xi = x[i], yi = y[i];
+    x[i] = cs * xi - sn * yi;
+    y[i] = sn * xi + cs * yi;
+  }
+  return c;
+}
+
+struct sv_index {
+  double s;
+  int j;
+};
+
+// Largest first, ties by column so every process picks the same order
+static int cmp_sv(const void *a, const void *b) {
+  const struct sv_index *x = a, *y = b;
+  if (x->s != y->s)
+    return (x->s < y->s) ? 1 : -1;
+  return x->j - y->j;
+}
+
+thin_svd *svd_mpi(int m, int n, double **A, int k, int *sweeps) {
+  int rank, np;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+
+  // work on the columns of A, or of A^T when that has fewer of them
+  int tr = m < n;
+  int nc = tr ? m : n, len = tr ? n : m;
+  int w = len + nc; // a column is stored with its column of V after it
+  int nb = 2 * np;
+  int maxc = (nc + nb - 1) / nb;
+  double *buf[2], *spare[2];
+  for (int t = 0; t < 2; t++) {
+    buf[t] = (double *)malloc(((size_t)maxc * w + 1) * sizeof(double));
+    spare[t] = (double *)malloc(((size_t)maxc * w + 1) * sizeof(double));
+  }
+  int id[2] = {block_at(nb, 0, rank), block_at(nb, 0, nb - 1 - rank)};
+
+  // rank 0 hands out the blocks, with V starting as the identity
+  if (rank == 0) {
+    double *tmp = (double *)malloc(((size_t)maxc * w + 1) * sizeof(double));
+    for (int b = 0; b < nb; b++) {
+      int lo = block_lo(nc, nb, b), cnt = block_lo(nc, nb, b + 1) - lo;
+      memset(tmp, 0, (size_t)cnt * w * sizeof(double));
+      for (int c = 0; c < cnt; c++) {
+        double *col = tmp + (size_t)c * w;
+        for (int i = 0; i < len; i++)
+          col[i] = tr ? A[lo + c][i] : A[i][lo + c];
+        col[len + lo + c] = 1.0;
+      }
+      int o = owner(nb, 0, b);
+      if (o == 0)
+        memcpy(buf[(b == id[0]) ? 0 : 1], tmp,
+               (size_t)cnt * w * sizeof(double));
+      else
+        MPI_Send(tmp, cnt * w, MPI_DOUBLE, o, b, MPI_COMM_WORLD);
+    }
+    free(tmp);
+  } else {
+    for (int t = 0; t < 2; t++) {
+      int cnt = block_lo(nc, nb, id[t] + 1) - block_lo(nc, nb, id[t]);
+      MPI_Recv(buf[t], cnt * w, MPI_DOUBLE, 0, id[t], MPI_COMM_WORLD,
+               MPI_STATUS_IGNORE);
+    }
+  }
+
+  double zero = 0.0;
+  for (int t = 0; t < 2; t++) {
+    int cnt = block_lo(nc, nb, id[t] + 1) - block_lo(nc, nb, id[t]);
+    for (int c = 0; c < cnt; c++)
+      for (int i = 0; i < len; i++)
+        zero += buf[t][(size_t)c * w + i] * buf[t][(size_t)c * w + i];
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &zero, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  zero *= ONESIDED_ZERO;
+
+  int sw;
+  double off = 1.0;
+  for (sw = 0; sw < ONESIDED_MAX_SWEEPS && off >= ONESIDED_TOL; sw++) {
+    double local = 0.0;
+    for (int s = 0; s < nb - 1; s++) {
+      int cnt[2];
+      for (int t = 0; t < 2; t++)
+        cnt[t] = block_lo(nc, nb, id[t] + 1) - block_lo(nc, nb, id[t]);
+      if (s == 0)
+        for (int t = 0; t < 2; t++)
+          for (int i = 0; i < cnt[t]; i++)
+            for (int j = i + 1; j < cnt[t]; j++)
+              local = fmax(local, rotate(buf[t] + (size_t)i * w,
+                                         buf[t] + (size_t)j * w, len, nc,
+                                         zero));
+      for (int i = 0; i < cnt[0]; i++)
+        for (int j = 0; j < cnt[1]; j++)
+          local = fmax(local, rotate(buf[0] + (size_t)i * w,
+                                     buf[1] + (size_t)j * w, len, nc, zero));
+
+      // pass the blocks on to their owners in step s + 1
+      MPI_Request req[4];
+      int nr = 0;
+      int next[2] = {block_at(nb, s + 1, rank),
+                     block_at(nb, s + 1, nb - 1 - rank)};
+      for (int t = 0; t < 2; t++) {
+        int dest = owner(nb, s + 1, id[t]);
+        if (dest != rank)
+          MPI_Isend(buf[t], cnt[t] * w, MPI_DOUBLE, dest, id[t],
+                    MPI_COMM_WORLD, &req[nr++]);
+      }
+      for (int t = 0; t < 2; t++) {
+        int b = next[t];
+        int c = block_lo(nc, nb, b + 1) - block_lo(nc, nb, b);
+        if (b == id[0] || b == id[1])
+          memcpy(spare[t], buf[(b == id[0]) ? 0 : 1],
+                 (size_t)c * w * sizeof(double));
+        else
+          MPI_Irecv(spare[t], c * w, MPI_DOUBLE, owner(nb, s, b), b,
+                    MPI_COMM_WORLD, &req[nr++]);
+      }
+      MPI_Waitall(nr, req, MPI_STATUSES_IGNORE);
+      for (int t = 0; t < 2; t++) {
+        double *p = buf[t];
+        buf[t] = spare[t];
+        spare[t] = p;
+        id[t] = next[t];
+      }
+    }
+    MPI_Allreduce(&local, &off, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  }
+  if (sweeps)
+    *sweeps = sw;
+
+  // the column norms are the singular values
+  double *sv = (double *)calloc(nc, sizeof(double));
+  for (int t = 0; t < 2; t++) {
+    int lo = block_lo(nc, nb, id[t]), cnt = block_lo(nc, nb, id[t] + 1) - lo;
+    for (int c = 0; c < cnt; c++) {
+      double *col = buf[t] + (size_t)c * w, s = 0.0;
+      for (int i = 0; i < len; i++)
+        s += col[i] * col[i];
+      sv[lo + c] = sqrt(s);
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, sv, nc, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  struct sv_index *order =
+      (struct sv_index *)malloc(nc * sizeof(struct sv_index));
+  for (int j = 0; j < nc; j++) {
+    order[j].s = sv[j];
+    order[j].j = j;
+  }
+  qsort(order, nc, sizeof(struct sv_index), cmp_sv);
+  int r = (k > 0 && k < nc) ? k : nc;
+
+  // only the r leading columns go to rank 0, sent in that order so the
+  // receives from each process match up
+  thin_svd *ret = NULL;
+  double *col = (double *)malloc(w * sizeof(double));
+  if (rank == 0) {
+    ret = (thin_svd *)malloc(sizeof(thin_svd));
+    ret->m = m;
+    ret->n = n;
+    ret->r = r;
+    ret->S = (double *)malloc(r * sizeof(double));
+    ret->U = (double **)malloc(m * sizeof(double *));
+    for (int i = 0; i < m; i++)
+      ret->U[i] = (double *)malloc(r * sizeof(double));
+    ret->V = (double **)malloc(n * sizeof(double *));
+    for (int i = 0; i < n; i++)
+      ret->V[i] = (double *)malloc(r * sizeof(double));
+  }
+  for (int t = 0; t < r; t++) {
+    int j = order[t].j, b = block_of(nc, nb, j);
+    int o = owner(nb, 0, b);
+    double *src = NULL;
+    if (o == rank)
+      src = buf[(b == id[0]) ? 0 : 1] + (size_t)(j - block_lo(nc, nb, b)) * w;
+    if (rank == 0) {
+      if (o != 0) {
+        MPI_Recv(col, w, MPI_DOUBLE, o, j, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        src = col;
+      }
+      // A = W V^T (or A^T = W V^T), with the columns of W equal to sigma u
+      double sigma = order[t].s;
+      ret->S[t] = sigma;
+      double **left = tr ? ret->V : ret->U, **right = tr ? ret->U : ret->V;
+      for (int i = 0; i < len; i++)
+        left[i][t] = (sigma > 0) ? src[i] / sigma : 0.0;
+      for (int i = 0; i < nc; i++)
+        right[i][t] = src[len + i];
+    } else if (o == rank) {
+      MPI_Send(src, w, MPI_DOUBLE, 0, j, MPI_COMM_WORLD);
+    }
+  }
+
+  free(col);
+  free(order);
+  free(sv);
+  for (int t = 0; t < 2; t++) {
+    free(buf[t]);
+    free(spare[t]);
+  }
+  return ret;
+}
+
+int run_mpi(const char *src, int k) {
+  MPI_Init(NULL, NULL);
+  int rank, np;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+
+  int ihdr[7] = {0};
+  int **array = NULL;
+  double **A = NULL;
+  if (rank == 0) {
+    array = readpng(src, ihdr);
+    if (!array) {
+      fprintf(stderr, "Failed to read PNG file %s\n", src);
+      ihdr[0] = 0;
+    } else {
+      A = (double **)malloc(ihdr[1] * sizeof(double *));
+      for (int i = 0; i < ihdr[1]; i++) {
+        A[i] = (double *)malloc(ihdr[0] * sizeof(double));
+        for (int j = 0; j < ihdr[0]; j++)
+          A[i][j] = (double)array[i][j];
+      }
+    }
+  }
+  MPI_Bcast(ihdr, 7, MPI_INT, 0, MPI_COMM_WORLD);
+  if (ihdr[0] == 0) {
+    MPI_Finalize();
+    return -1;
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double t0 = MPI_Wtime();
+  int sweeps;
+  thin_svd *t = svd_mpi(ihdr[1], ihdr[0], A, k, &sweeps);
+  double ms = (MPI_Wtime() - t0) * 1e3;
+
+  if (rank == 0) {
+    printf("One-sided Jacobi on %d processes: %d sweeps, %.2f ms\n", np,
+           sweeps, ms);
+    double **A_k = low_rank_approx_thin(t, k);
+    double err2 = 0.0;
+    for (int i = 0; i < ihdr[1]; i++)
+      for (int j = 0; j < ihdr[0]; j++) {
+        double d = array[i][j] - (int)A_k[i][j];
+        err2 += d * d;
+      }
+    double frob_norm = sqrt(err2);
+    printf("Frobenius norm of the difference between original and A_k: "
+           "%.5lf\n",
+           frob_norm);
+    printf("Frobenius norm error per pixel: %.5lf\n",
+           frob_norm / (ihdr[1] * ihdr[0]));
+    int out[7] = {ihdr[0], ihdr[1], 8, 0, 0, 0, 0};
+    savepng_from("out.png", A_k, ihdr[2], out, 0);
+
+    for (int i = 0; i < ihdr[1]; i++)
+      free(array[i]);
+    free(array);
+    free_matrix(ihdr[1], A);
+    free_matrix(ihdr[1], A_k);
+    free_thin_svd(t);
+  }
+  MPI_Finalize();
+  return 0;
+}
+
+#else
+
+int run_mpi(const char *src, int k) {
+  (void)src;
+  (void)k;
+  fprintf(stderr, "--mpi needs a build with mpicc -DUSE_MPI\n");
+  return -1;
+}
+
+#endif // USE_MPI
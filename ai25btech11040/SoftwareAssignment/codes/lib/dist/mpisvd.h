@@ -0,0 +1,17 @@
+#ifndef MPISVD_H
+#define MPISVD_H
+
+#include "../matrix/svd.h"
+
+// Only built with mpicc -DUSE_MPI; without it run_mpi() just reports that.
+
+// Collective over MPI_COMM_WORLD. m and n must be the same on every rank, A
+// is only read on rank 0 (NULL elsewhere). Returns the k leading triplets on
+// rank 0 and NULL on the other ranks.
+thin_svd *svd_mpi(int m, int n, double **A, int k, int *sweeps);
+
+// Initializes MPI, compresses src at rank k with svd_mpi() and writes
+// out.png from rank 0
+int run_mpi(const char *src, int k);
+
+#endif // MPISVD_H
@@ -0,0 +1,318 @@
+// Batched SVD of small square blocks by one-sided (Hestenes) Jacobi. Blocks
+// are processed BATCH_LANES at a time: each group is stored interleaved, with
+// element (i, j) of all its blocks next to each other, so every step of the
+// algorithm is the same arithmetic on BATCH_LANES contiguous doubles, one
+// block per SIMD lane. There is no convergence test, which would make lanes
+// diverge: each size runs a fixed number of sweeps, enough for double
+// precision on 8-bit data (see report.md). The kernels are compiled once per
+// block size, so every loop bound is a constant, and once per instruction
+// set, picked at run time as in gram.c.
+
+#include "batched.h"
+#include "../png/readpng.h"
+#include "../png/savepng.h"
+#include "helper.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_X86 1
+#endif
+
+#define BATCH_LANES 8 // blocks per group: one AVX-512 register of doubles
+
+// Sweeps for each block size
+#define BATCH_SWEEPS_8 6
+#define BATCH_SWEEPS_16 8
+#define BATCH_SWEEPS_32 9
+
+// Element (i, j) of every block in a group: the kernels below are written on
+// this type, so each operation is one instruction (or 2 or 4 on narrower
+// SIMD) across the group
+typedef double lanes __attribute__((vector_size(BATCH_LANES * sizeof(double))));
+
+typedef long long mask __attribute__((vector_size(BATCH_LANES * 8)));
+
+typedef void (*group_fn)(lanes *a, lanes *v);
+
+// Square roots of a group of lanes. sqrt() itself would stay scalar, since it
+// may have to set errno.
+typedef void (*sqrt_fn)(lanes *x);
+
+static inline __attribute__((always_inline)) void sqrt_lanes(lanes *x) {
+#ifdef BATCH_X86
+  double *d = (double *)x;
+  for (int l = 0; l < BATCH_LANES; l += 2)
+    _mm_storeu_pd(d + l, _mm_sqrt_pd(_mm_loadu_pd(d + l)));
+#else
+  for (int l = 0; l < BATCH_LANES; l++)
+    (*x)[l] = sqrt((*x)[l]);
+#endif
+}
+
+#ifdef BATCH_X86
+__attribute__((target("avx2"))) static inline
+    __attribute__((always_inline)) void
+    sqrt_avx2(lanes *x) {
+  double *d = (double *)x;
+  for (int l = 0; l < BATCH_LANES; l += 4)
+    _mm256_storeu_pd(d + l, _mm256_sqrt_pd(_mm256_loadu_pd(d + l)));
+}
+
+__attribute__((target("avx512f"))) static inline
+    __attribute__((always_inline)) void
+    sqrt_avx512(lanes *x) {
+  double *d = (double *)x;
+  _mm512_storeu_pd(d, _mm512_sqrt_pd(_mm512_loadu_pd(d)));
+}
+#endif
+
+// Rotates columns p and q of every block in the group: a holds the blocks,
+// v their right singular vectors so far, element (i, j) at a[j * N + i], so
+// that a column is contiguous
+static inline __attribute__((always_inline)) void
+rotate_pair(const int N, sqrt_fn vsqrt, lanes *a, lanes *v, int p, int q) {
+  lanes *x = a + p * N, *y = a + q * N;
+  lanes al = {0}, be = {0}, ga = {0};
+  for (int i = 0; i < N; i++) {
+    al += x[i] * x[i];
+    be += y[i] * y[i];
+    ga += x[i] * y[i];
+  }
+  // The rotation that makes the two columns orthogonal, or none in lanes
+  // where they already are (|gamma| <= eps sqrt(alpha beta)):
+  //   zeta = (beta - alpha) / (2 gamma)
+  //   t = sign(zeta) / (|zeta| + sqrt(1 + zeta^2)), c = 1 / sqrt(1 + t^2)
+  // without branches, the selections done with bit masks
+  const lanes one = (lanes){0} + 1.0;
+  const mask sign = (mask)(-(lanes){0}); // -0.0: only the sign bit
+  mask rot = ga * ga > (DBL_EPSILON * DBL_EPSILON) * al * be;
+  lanes g = (lanes)(((mask)ga & rot) | ((mask)one & ~rot));
+  lanes zeta = (be - al) / (2.0 * g);
+  lanes root = one + zeta * zeta;
+  vsqrt(&root);
+  lanes t = one / ((lanes)((mask)zeta & ~sign) + root);
+  t = (lanes)((((mask)t) | ((mask)zeta & sign)) & rot);
+  lanes c = one + t * t;
+  vsqrt(&c);
+  c = one / c;
+  lanes s = c * t;
+
+  lanes *vx = v + p * N, *vy = v + q * N;
+  for (int i = 0; i < N; i++) {
+    lanes xa = x[i], ya = y[i], xv = vx[i], yv = vy[i];
+    x[i] = c * xa - s * ya;
+    y[i] = s * xa + c * ya;
+    vx[i] = c * xv - s * yv;
+    vy[i] = s * xv + c * yv;
+  }
+}
+
+static inline __attribute__((always_inline)) void
+jacobi_group(const int N, const int sweeps, sqrt_fn vsqrt, lanes *a,
+             lanes *v) {
+  for (int sw = 0; sw < sweeps; sw++)
+    for (int p = 0; p < N - 1; p++)
+      for (int q = p + 1; q < N; q++)
+        rotate_pair(N, vsqrt, a, v, p, q);
+}
+
+#define GROUP_KERNEL(N, SUFFIX, TARGET, SQRT)                                  \
+  TARGET static void group_##N##SUFFIX(lanes *a, lanes *v) {                   \
+    jacobi_group(N, BATCH_SWEEPS_##N, SQRT, a, v);                             \
+  }
+
+#define GROUP_KERNELS(SUFFIX, TARGET, SQRT)                                    \
+  GROUP_KERNEL(8, SUFFIX, TARGET, SQRT)                                        \
+  GROUP_KERNEL(16, SUFFIX, TARGET, SQRT)                                       \
+  GROUP_KERNEL(32, SUFFIX, TARGET, SQRT)
+
+GROUP_KERNELS(, , sqrt_lanes)
+#ifdef BATCH_X86
+GROUP_KERNELS(_avx2, __attribute__((target("avx2"))), sqrt_avx2)
+GROUP_KERNELS(_avx512, __attribute__((target("avx512f"))), sqrt_avx512)
+#endif
+
+static group_fn pick_kernel(int size) {
+  int isa = 0;
+#ifdef BATCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    isa = 2;
+  else if (__builtin_cpu_supports("avx2"))
+    isa = 1;
+  static const group_fn table[3][3] = {
+      {group_8, group_16, group_32},
+      {group_8_avx2, group_16_avx2, group_32_avx2},
+      {group_8_avx512, group_16_avx512, group_32_avx512}};
+#else
+  static const group_fn table[1][3] = {{group_8, group_16, group_32}};
+#endif
+  switch (size) {
+  case 8:
+    return table[isa][0];
+  case 16:
+    return table[isa][1];
+  case 32:
+    return table[isa][2];
+  }
+  return NULL;
+}
+
+int svd_batched(int count, int size, const double *A, double *U, double *S,
+                double *V) {
+  group_fn kernel = pick_kernel(size);
+  if (!kernel)
+    return -1;
+  int N = size, NN = size * size;
+  lanes *a = (lanes *)aligned_alloc(sizeof(lanes), NN * sizeof(lanes));
+  lanes *v = (lanes *)aligned_alloc(sizeof(lanes), NN * sizeof(lanes));
+  double *norm = (double *)malloc(N * sizeof(double));
+  int *idx = (int *)malloc(N * sizeof(int));
+
+  for (int first = 0; first < count; first += BATCH_LANES) {
+    int lanes_used =
+        (count - first < BATCH_LANES) ? count - first : BATCH_LANES;
+    // interleave; unused lanes are zero blocks and are never rotated
+    memset(a, 0, NN * sizeof(lanes));
+    memset(v, 0, NN * sizeof(lanes));
+    for (int l = 0; l < lanes_used; l++) {
+      const double *blk = A + (size_t)(first + l) * NN;
+      for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+          a[j * N + i][l] = blk[i * N + j];
+    }
+    for (int i = 0; i < N; i++)
+      for (int l = 0; l < BATCH_LANES; l++)
+        v[i * N + i][l] = 1.0;
+
+    kernel(a, v);
+
+    // sigma_j is the norm of column j, u_j the column divided by it
+    for (int l = 0; l < lanes_used; l++) {
+      size_t b = first + l;
+      for (int j = 0; j < N; j++) {
+        double s2 = 0.0;
+        for (int i = 0; i < N; i++) {
+          double x = a[j * N + i][l];
+          s2 += x * x;
+        }
+        norm[j] = sqrt(s2);
+        int t = j - 1;
+        while (t >= 0 && norm[idx[t]] < norm[j]) {
+          idx[t + 1] = idx[t];
+          t--;
+        }
+        idx[t + 1] = j;
+      }
+      for (int t = 0; t < N; t++) {
+        int j = idx[t];
+        S[b * N + t] = norm[j];
+        for (int i = 0; i < N; i++) {
+          if (U)
+            U[b * NN + i * N + t] =
+                (norm[j] > 0.0) ? a[j * N + i][l] / norm[j]
+                                : 0.0;
+          if (V)
+            V[b * NN + i * N + t] = v[j * N + i][l];
+        }
+      }
+    }
+  }
+  free(a);
+  free(v);
+  free(norm);
+  free(idx);
+  return 0;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int run_tiles(const char *src, int size, int k) {
+  if (size != 8 && size != 16 && size != 32) {
+    fprintf(stderr, "Tile size must be 8, 16 or 32\n");
+    return -1;
+  }
+  if (k < 1)
+    k = 1;
+  if (k > size)
+    k = size;
+  int ihdr[7];
+  int **array = readpng(src, ihdr);
+  if (!array) {
+    fprintf(stderr, "Failed to read PNG file %s\n", src);
+    return -1;
+  }
+  int m = ihdr[1], n = ihdr[0], NN = size * size;
+  int ty = (m + size - 1) / size, tx = (n + size - 1) / size;
+  int count = ty * tx;
+  double *T = (double *)malloc((size_t)count * NN * sizeof(double));
+  double *U = (double *)malloc((size_t)count * NN * sizeof(double));
+  double *V = (double *)malloc((size_t)count * NN * sizeof(double));
+  double *S = (double *)malloc((size_t)count * size * sizeof(double));
+  // tiles past the edge repeat the last row/column
+  for (int b = 0; b < count; b++)
+    for (int i = 0; i < size; i++)
+      for (int j = 0; j < size; j++) {
+        int y = (b / tx) * size + i, x = (b % tx) * size + j;
+        T[(size_t)b * NN + i * size + j] =
+            array[y < m ? y : m - 1][x < n ? x : n - 1];
+      }
+
+  double t0 = now_ms();
+  svd_batched(count, size, T, U, S, V);
+  double ms = now_ms() - t0;
+  printf("%d tiles of %d x %d: %.2f ms, %.0f blocks/s per core\n", count,
+         size, size, ms, count / (ms / 1e3));
+
+  double **A_k = (double **)malloc(m * sizeof(double *));
+  for (int i = 0; i < m; i++)
+    A_k[i] = (double *)malloc(n * sizeof(double));
+  double err2 = 0.0;
+  for (int b = 0; b < count; b++) {
+    const double *u = U + (size_t)b * NN, *v = V + (size_t)b * NN;
+    const double *s = S + (size_t)b * size;
+    for (int i = 0; i < size; i++) {
+      int y = (b / tx) * size + i;
+      if (y >= m)
+        break;
+      for (int j = 0; j < size; j++) {
+        int x = (b % tx) * size + j;
+        if (x >= n)
+          break;
+        double sum = 0.0;
+        for (int t = 0; t < k; t++)
+          sum += s[t] * u[i * size + t] * v[j * size + t];
+        A_k[y][x] = sum;
+        double d = array[y][x] - (int)sum;
+        err2 += d * d;
+      }
+    }
+  }
+  double frob_norm = sqrt(err2);
+  printf("Frobenius norm of the difference between original and A_k: %.5lf\n",
+         frob_norm);
+  printf("Frobenius norm error per pixel: %.5lf\n", frob_norm / (m * n));
+  printf("Compression ratio: %.2f\n",
+         (double)NN / (k * (2 * size + 1)));
+  int out[7] = {n, m, 8, 0, 0, 0, 0};
+  savepng_from("out.png", A_k, ihdr[2], out, 0);
+
+  for (int i = 0; i < m; i++)
+    free(array[i]);
+  free(array);
+  free_matrix(m, A_k);
+  free(T);
+  free(U);
+  free(V);
+  free(S);
+  return 0;
+}
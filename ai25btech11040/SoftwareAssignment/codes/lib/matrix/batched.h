@@ -0,0 +1,16 @@
+#ifndef BATCHED_H
+#define BATCHED_H
+
+// SVD of count square blocks of size 8, 16 or 32, stored row-major one after
+// another in A (count * size * size doubles). Block b gets U and V (size x
+// size, row-major, at the same offsets as in A, singular vectors in the
+// columns) and S (size values at S + b * size, descending). U or V may be
+// NULL if not needed. Returns 0, or -1 for any other size.
+int svd_batched(int count, int size, const double *A, double *U, double *S,
+                double *V);
+
+// Compresses src tile by tile (size x size tiles, rank k each) with
+// svd_batched(), reports blocks per second and the error, writes out.png
+int run_tiles(const char *src, int size, int k);
+
+#endif // BATCHED_H
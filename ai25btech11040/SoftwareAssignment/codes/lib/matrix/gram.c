@@ -0,0 +1,222 @@
+// Exact Gram matrix of an 8-bit image. The columns are repacked as contiguous
+// byte vectors, and each entry of A^T A is the dot product of two of them.
+// The dot products run in 32-bit SIMD lanes (pmaddwd on AVX2, vpdpbusd on
+// AVX-512 VNNI), which are added into 64-bit totals every GRAM_CHUNK bytes,
+// before they can overflow. Integer sums are exact, so the result is the same
+// whichever kernel runs and however the rows of G are split between threads,
+// and also the same as the double precision product (every partial sum is
+// an integer below 2^53).
+
+#include "gram.h"
+#include "helper.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GRAM_X86 1
+#endif
+
+#define GRAM_PAD 64 // columns are padded with zeros to a multiple of this
+// Bytes per 32-bit partial sum: a pmaddwd lane gains at most 2 * 255 * 255
+// per 16 bytes, a vpdpbusd lane 4 * 255 * 128 per 64 bytes, and both stay
+// below 2^31 over 2^18 bytes
+#define GRAM_CHUNK 262144
+
+struct columns {
+  int n, len;       // columns, padded length
+  unsigned char *u; // column j at u + j * len
+  signed char *s;   // the same bytes minus 128, for vpdpbusd (u8 x s8)
+  int64_t *sum;     // column sums
+};
+
+// out[t] = column i . column y[t], for t < 4
+typedef void (*dot4_fn)(const struct columns *c, int i, const int *y,
+                        int64_t *out);
+
+static void dot4_scalar(const struct columns *c, int i, const int *y,
+                        int64_t *out) {
+  const unsigned char *x = c->u + (size_t)i * c->len;
+  for (int t = 0; t < 4; t++) {
+    const unsigned char *v = c->u + (size_t)y[t] * c->len;
+    int64_t s = 0;
+    for (int p = 0; p < c->len; p++)
+      s += x[p] * v[p];
+    out[t] = s;
+  }
+}
+
+#ifdef GRAM_X86
+__attribute__((target("avx2"))) static void
+dot4_avx2(const struct columns *c, int i, const int *y, int64_t *out) {
+  const unsigned char *x = c->u + (size_t)i * c->len;
+  const unsigned char *v[4];
+  for (int t = 0; t < 4; t++) {
+    v[t] = c->u + (size_t)y[t] * c->len;
+    out[t] = 0;
+  }
+  for (int lo = 0; lo < c->len; lo += GRAM_CHUNK) {
+    int hi = (lo + GRAM_CHUNK < c->len) ? lo + GRAM_CHUNK : c->len;
+    __m256i acc[4];
+    for (int t = 0; t < 4; t++)
+      acc[t] = _mm256_setzero_si256();
+    for (int p = lo; p < hi; p += 16) {
+      __m256i xv =
+          _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(x + p)));
+      for (int t = 0; t < 4; t++) {
+        __m256i vv = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128((const __m128i *)(v[t] + p)));
+        acc[t] = _mm256_add_epi32(acc[t], _mm256_madd_epi16(xv, vv));
+      }
+    }
+    for (int t = 0; t < 4; t++) {
+      int32_t lane[8];
+      _mm256_storeu_si256((__m256i *)lane, acc[t]);
+      for (int l = 0; l < 8; l++)
+        out[t] += lane[l];
+    }
+  }
+}
+
+// x . v = x . (v - 128) + 128 sum(x), the first term in u8 x s8 products
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) static void
+dot4_vnni(const struct columns *c, int i, const int *y, int64_t *out) {
+  const unsigned char *x = c->u + (size_t)i * c->len;
+  const signed char *v[4];
+  for (int t = 0; t < 4; t++) {
+    v[t] = c->s + (size_t)y[t] * c->len;
+    out[t] = 128 * c->sum[i];
+  }
+  for (int lo = 0; lo < c->len; lo += GRAM_CHUNK) {
+    int hi = (lo + GRAM_CHUNK < c->len) ? lo + GRAM_CHUNK : c->len;
+    __m512i acc[4];
+    for (int t = 0; t < 4; t++)
+      acc[t] = _mm512_setzero_si512();
+    for (int p = lo; p < hi; p += 64) {
+      __m512i xv = _mm512_loadu_si512(x + p);
+      for (int t = 0; t < 4; t++)
+        acc[t] =
+            _mm512_dpbusd_epi32(acc[t], xv, _mm512_loadu_si512(v[t] + p));
+    }
+    for (int t = 0; t < 4; t++) {
+      __m512i w = _mm512_add_epi64(
+          _mm512_cvtepi32_epi64(_mm512_castsi512_si256(acc[t])),
+          _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(acc[t], 1)));
+      out[t] += _mm512_reduce_add_epi64(w);
+    }
+  }
+}
+#endif
+
+static dot4_fn pick_kernel(void) {
+#ifdef GRAM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512vnni") &&
+      __builtin_cpu_supports("avx512bw"))
+    return dot4_vnni;
+  if (__builtin_cpu_supports("avx2"))
+    return dot4_avx2;
+#endif
+  return dot4_scalar;
+}
+
+struct gram_job {
+  const struct columns *c;
+  dot4_fn dot4;
+  double **G;
+  int first, stride;
+};
+
+// Rows first, first + stride, ... of G, upper triangle mirrored below
+static void *gram_worker(void *arg) {
+  struct gram_job *job = arg;
+  int n = job->c->n;
+  for (int i = job->first; i < n; i += job->stride) {
+    for (int j = i; j < n; j += 4) {
+      int y[4];
+      int64_t out[4];
+      for (int t = 0; t < 4; t++)
+        y[t] = (j + t < n) ? j + t : n - 1;
+      job->dot4(job->c, i, y, out);
+      for (int t = 0; t < 4 && j + t < n; t++)
+        job->G[i][j + t] = job->G[j + t][i] = (double)out[t];
+    }
+  }
+  return NULL;
+}
+
+double **gram_u8(int m, int n, unsigned char **A, int threads) {
+  struct columns c;
+  c.n = n;
+  c.len = (m + GRAM_PAD - 1) / GRAM_PAD * GRAM_PAD;
+  c.u = (unsigned char *)calloc((size_t)n * c.len, 1);
+  c.s = (signed char *)malloc((size_t)n * c.len);
+  c.sum = (int64_t *)calloc(n, sizeof(int64_t));
+  for (int i = 0; i < m; i++)
+    for (int j = 0; j < n; j++) {
+      c.u[(size_t)j * c.len + i] = A[i][j];
+      c.sum[j] += A[i][j];
+    }
+  for (size_t p = 0; p < (size_t)n * c.len; p++)
+    c.s[p] = (signed char)(c.u[p] ^ 0x80);
+
+  double **G = (double **)malloc(n * sizeof(double *));
+  for (int i = 0; i < n; i++)
+    G[i] = (double *)malloc(n * sizeof(double));
+
+  if (threads <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (cores > 1) ? (int)cores : 1;
+  }
+  if (threads > n)
+    threads = (n > 0) ? n : 1;
+  dot4_fn dot4 = pick_kernel();
+  pthread_t *th = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  struct gram_job *jobs =
+      (struct gram_job *)malloc(threads * sizeof(struct gram_job));
+  for (int t = 0; t < threads; t++) {
+    jobs[t] = (struct gram_job){&c, dot4, G, t, threads};
+    if (t > 0)
+      pthread_create(&th[t], NULL, gram_worker, &jobs[t]);
+  }
+  gram_worker(&jobs[0]);
+  for (int t = 1; t < threads; t++)
+    pthread_join(th[t], NULL);
+
+  free(th);
+  free(jobs);
+  free(c.u);
+  free(c.s);
+  free(c.sum);
+  return G;
+}
+
+double **gram_ata(int m, int n, double **A) {
+  unsigned char **B = (unsigned char **)malloc(m * sizeof(unsigned char *));
+  int rows = 0, bytes = 1;
+  for (; rows < m && bytes; rows++) {
+    B[rows] = (unsigned char *)malloc(n);
+    for (int j = 0; j < n; j++) {
+      double v = A[rows][j];
+      if (!(v >= 0.0 && v <= 255.0 && v == (int)v)) {
+        bytes = 0;
+        break;
+      }
+      B[rows][j] = (unsigned char)v;
+    }
+  }
+  double **G;
+  if (bytes) {
+    G = gram_u8(m, n, B, 0);
+  } else {
+    double **at = transpose(m, n, A);
+    G = multiply(n, m, at, m, n, A);
+    free_matrix(n, at);
+  }
+  for (int i = 0; i < rows; i++)
+    free(B[i]);
+  free(B);
+  return G;
+}
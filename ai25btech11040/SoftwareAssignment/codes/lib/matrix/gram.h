@@ -0,0 +1,13 @@
+#ifndef GRAM_H
+#define GRAM_H
+
+// A^T A (n x n) for the m x n 8-bit image A, computed exactly in integer
+// arithmetic with SIMD where the CPU has it, split over `threads` threads
+// (all cores if <= 0). The result does not depend on the number of threads.
+double **gram_u8(int m, int n, unsigned char **A, int threads);
+
+// A^T A for any m x n A. If every entry is an integer in 0..255 (a decoded
+// 8-bit image) this goes through gram_u8(), otherwise through multiply().
+double **gram_ata(int m, int n, double **A);
+
+#endif // GRAM_H
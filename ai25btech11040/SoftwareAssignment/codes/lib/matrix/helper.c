@@ -20,6 +20,14 @@ double **multiply(int m1, int n1, double **A, int m2, int n2, double **B) {
   return C;
 }
 
+void free_matrix(int m, double **A) {
+  if (!A)
+    return;
+  for (int i = 0; i < m; i++)
+    free(A[i]);
+  free(A);
+}
+
 double **transpose(int m, int n, double **A) {
   double **T = (double **)malloc(n * sizeof(double *));
   for (int i = 0; i < n; i++) {
@@ -40,26 +48,102 @@ void normalize(double *v, int n) {
     v[i] /= norm;
 }
 
+static int cmp_desc(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x < y) - (x > y);
+}
+
+// Largest |A[i][j]| right of the diagonal in row i, first column on ties
+static void row_max(double **A, int n, int i, double *rmax, int *rcol) {
+    rmax[i] = 0.0;
+    rcol[i] = i + 1;
+    for (int j = i + 1; j < n; ++j) {
+        double a = fabs(A[i][j]);
+        if (a > rmax[i]) { rmax[i] = a; rcol[i] = j; }
+    }
+}
+
+// Refresh the row maxima after rotating the pair (p, q), p < q. Rows p and q
+// change entirely; every other row k < q changes only in columns p and q,
+// and needs a rescan only when one of those held its maximum.
+static void update_row_max(double **A, int n, int p, int q, double *rmax,
+                           int *rcol) {
+    row_max(A, n, p, rmax, rcol);
+    row_max(A, n, q, rmax, rcol);
+    for (int k = 0; k < q; ++k) {
+        if (k == p) continue;
+        if (rcol[k] == p || rcol[k] == q) {
+            row_max(A, n, k, rmax, rcol);
+            continue;
+        }
+        for (int t = 0; t < 2; ++t) {
+            int j = t ? q : p;
+            if (j <= k) continue;
+            double a = fabs(A[k][j]);
+            if (a > rmax[k] || (a == rmax[k] && j < rcol[k])) {
+                rmax[k] = a;
+                rcol[k] = j;
+            }
+        }
+    }
+}
+
 // Algorithm to find eigenvalues and eigenvectors using Jacobi method (only for
-// symmetric matrices)
-void jacobi(double **A, double *eigvals, double **eigvecs, int n) {
+// symmetric matrices). Stops once every off-diagonal entry is below 1e-12, or,
+// when slack > 0, once every pair satisfies |A[p][q]| <= slack*|A[p][p]-A[q][q]|
+// (see grey_slack()). With 0 < k < n only pairs straddling the current top k
+// diagonal entries are checked, since rotations within either side do not
+// change a rank-k truncation. Returns the number of rotations performed.
+//
+// In strict mode the pivot comes from an index of per-row maxima that is only
+// refreshed for the rows a rotation touches, O(n) per rotation instead of a
+// full O(n^2) scan. Ties are broken as in the scan (first row, then first
+// column), so the rotations and the results are bit for bit the same.
+int jacobi_tol(double **A, double *eigvals, double **eigvecs, int n,
+               double slack, int k) {
     // initialize eigenvectors as identity
     for (int i = 0; i < n; ++i)
         for (int j = 0; j < n; ++j)
             eigvecs[i][j] = (i == j) ? 1.0 : 0.0;
 
     const double eps = 1e-12;
+    int cut = (slack > 0.0 && k > 0 && k < n);
+    double *diag = cut ? (double *)malloc(n * sizeof(double)) : NULL;
+    double *rmax = NULL;
+    int *rcol = NULL;
+    if (slack <= 0.0 && n > 1) {
+        rmax = (double *)malloc(n * sizeof(double));
+        rcol = (int *)malloc(n * sizeof(int));
+        for (int i = 0; i < n; ++i) row_max(A, n, i, rmax, rcol);
+    }
+    int rotations = 0;
     while (1) {
+        // diagonal entries at or above kth are (currently) kept
+        double kth = 0.0;
+        if (cut) {
+            for (int i = 0; i < n; ++i) diag[i] = A[i][i];
+            qsort(diag, n, sizeof(double), cmp_desc);
+            kth = diag[k - 1];
+        }
         // find largest off-diagonal element
         int p = 0, q = 1;
         double max_off = 0.0;
-        for (int i = 0; i < n; ++i) {
+        int settled = slack > 0.0;
+        if (rmax) {
+            for (int i = 0; i < n - 1; ++i)
+                if (rmax[i] > max_off) { max_off = rmax[i]; p = i; q = rcol[i]; }
+        }
+        for (int i = 0; i < n && !rmax; ++i) {
             for (int j = i + 1; j < n; ++j) {
                 double aij = fabs(A[i][j]);
                 if (aij > max_off) { max_off = aij; p = i; q = j; }
+                if (settled && aij > slack * fabs(A[i][i] - A[j][j]) &&
+                    (!cut || (A[i][i] >= kth) != (A[j][j] >= kth)))
+                    settled = 0;
             }
         }
-        if (max_off < eps) break;
+        if (max_off < eps || settled) break;
+        rotations++;
 
         double app = A[p][p], aqq = A[q][q], apq = A[p][q];
         double theta = 0.5 * atan2(2.0 * apq, (aqq - app));
@@ -85,6 +169,7 @@ void jacobi(double **A, double *eigvals, double **eigvecs, int n) {
             eigvecs[k][p] = c * vip - s * viq;
             eigvecs[k][q] = s * vip + c * viq;
         }
+        if (rmax) update_row_max(A, n, p, q, rmax, rcol);
     }
 
     // diagonal of A contains eigenvalues
@@ -100,6 +185,173 @@ void jacobi(double **A, double *eigvals, double **eigvecs, int n) {
             for (int i = 0; i < n; ++i) eigvecs[i][j] /= norm;
         }
     }
+    free(diag);
+    free(rmax);
+    free(rcol);
+    return rotations;
+}
+
+void jacobi(double **A, double *eigvals, double **eigvecs, int n) {
+    jacobi_tol(A, eigvals, eigvecs, n, 0.0, 0);
+}
+
+/*
+ * Translate an accuracy target in output grey levels into the slack used by
+ * jacobi_tol() on G = A^T A. Rotating a pair (p, q) by theta changes a pixel
+ * of any truncation A V_k V_k^T by at most 2 |theta| R, R being the largest row
+ * norm of A, and |theta| <= |g_pq| / |g_pp - g_qq|. So once every pair has
+ * |g_pq| <= grey / (2 R) * |g_pp - g_qq|, no single further rotation can move
+ * a pixel by more than grey levels. This bounds each rotation, not the sum of
+ * those a full solve would still apply; in practice the output stays within
+ * +-1 level of the strict solve (report.md). Returns 0 (strict mode) for
+ * grey <= 0.
+ */
+double grey_slack(int m, int n, double **A, double grey) {
+  if (grey <= 0.0)
+    return 0.0;
+  double R = 0.0;
+  for (int i = 0; i < m; i++) {
+    double r = 0.0;
+    for (int j = 0; j < n; j++)
+      r += A[i][j] * A[i][j];
+    if (r > R)
+      R = r;
+  }
+  R = sqrt(R);
+  return R > 0.0 ? grey / (2.0 * R) : 0.0;
+}
+
+// Implicit QL on a symmetric tridiagonal matrix with diagonal d and
+// off-diagonal e (e[i] couples i and i+1, e[n-1] unused). On return d holds
+// the eigenvalues and the columns of z (identity on input) the eigenvectors.
+void tridiagonal_eigen(int n, double *d, double *e, double **z) {
+  if (n > 0)
+    e[n - 1] = 0.0;
+  for (int l = 0; l < n; l++) {
+    int iter = 0, m;
+    do {
+      for (m = l; m < n - 1; m++) {
+        double dd = fabs(d[m]) + fabs(d[m + 1]);
+        if (fabs(e[m]) + dd == dd)
+          break;
+      }
+      if (m == l)
+        break;
+      if (iter++ == 60)
+        break; // give up on this eigenvalue, keep what we have
+      double g = (d[l + 1] - d[l]) / (2.0 * e[l]);
+      double r = hypot(g, 1.0);
+      g = d[m] - d[l] + e[l] / (g + copysign(r, g));
+      double s = 1.0, c = 1.0, p = 0.0;
+      int i;
+      for (i = m - 1; i >= l; i--) {
+        double f = s * e[i], b = c * e[i];
+        e[i + 1] = r = hypot(f, g);
+        if (r == 0.0) {
+          // underflow: deflate and restart the sweep
+          d[i + 1] -= p;
+          e[m] = 0.0;
+          break;
+        }
+        s = f / r;
+        c = g / r;
+        g = d[i + 1] - p;
+        r = (d[i] - g) * s + 2.0 * c * b;
+        p = s * r;
+        d[i + 1] = g + p;
+        g = c * r - b;
+        for (int k = 0; k < n; k++) {
+          f = z[k][i + 1];
+          z[k][i + 1] = s * z[k][i] + c * f;
+          z[k][i] = c * z[k][i] - s * f;
+        }
+      }
+      if (r == 0.0 && i >= l)
+        continue;
+      d[l] -= p;
+      e[l] = g;
+      e[m] = 0.0;
+    } while (m != l);
+  }
+}
+
+// Eigenvalues and eigenvectors of a dense symmetric matrix A (n x n, left
+// untouched) by Householder reduction to tridiagonal form followed by
+// tridiagonal_eigen(). O(n^3), much faster than jacobi() for larger n. The
+// eigenvalues are not sorted, evec holds the eigenvectors as columns.
+void symmetric_eigen(int n, double **A, double *ev, double **evec) {
+  double **a = evec;
+  double *e = (double *)malloc(n * sizeof(double));
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      a[i][j] = A[i][j];
+
+  // Householder reduction, a is replaced by the accumulated transform
+  for (int i = n - 1; i > 0; i--) {
+    int l = i - 1;
+    double h = 0.0, scale = 0.0;
+    if (l > 0) {
+      for (int k = 0; k <= l; k++)
+        scale += fabs(a[i][k]);
+      if (scale == 0.0) {
+        e[i] = a[i][l];
+      } else {
+        for (int k = 0; k <= l; k++) {
+          a[i][k] /= scale;
+          h += a[i][k] * a[i][k];
+        }
+        double f = a[i][l];
+        double g = (f >= 0.0) ? -sqrt(h) : sqrt(h);
+        e[i] = scale * g;
+        h -= f * g;
+        a[i][l] = f - g;
+        f = 0.0;
+        for (int j = 0; j <= l; j++) {
+          a[j][i] = a[i][j] / h;
+          g = 0.0;
+          for (int k = 0; k <= j; k++)
+            g += a[j][k] * a[i][k];
+          for (int k = j + 1; k <= l; k++)
+            g += a[k][j] * a[i][k];
+          e[j] = g / h;
+          f += e[j] * a[i][j];
+        }
+        double hh = f / (h + h);
+        for (int j = 0; j <= l; j++) {
+          f = a[i][j];
+          e[j] = g = e[j] - hh * f;
+          for (int k = 0; k <= j; k++)
+            a[j][k] -= f * e[k] + g * a[i][k];
+        }
+      }
+    } else {
+      e[i] = a[i][l];
+    }
+    ev[i] = h;
+  }
+  ev[0] = 0.0;
+  e[0] = 0.0;
+  for (int i = 0; i < n; i++) {
+    if (ev[i] != 0.0) {
+      for (int j = 0; j < i; j++) {
+        double g = 0.0;
+        for (int k = 0; k < i; k++)
+          g += a[i][k] * a[k][j];
+        for (int k = 0; k < i; k++)
+          a[k][j] -= g * a[k][i];
+      }
+    }
+    ev[i] = a[i][i];
+    a[i][i] = 1.0;
+    for (int j = 0; j < i; j++)
+      a[j][i] = a[i][j] = 0.0;
+  }
+
+  // e[i] couples i - 1 and i here, tridiagonal_eigen() wants i and i + 1
+  for (int i = 0; i + 1 < n; i++)
+    e[i] = e[i + 1];
+  tridiagonal_eigen(n, ev, e, a);
+  free(e);
 }
 
 void eigen_decomposition(int n, double **A, double *ev, double **evec) {
@@ -7,12 +7,23 @@ double **multiply(int m1, int n1, double **A, int m2, int n2, double **B);
 
 double **transpose(int m, int n, double **A);
 
+void free_matrix(int m, double **A);
+
 void eigen_decomposition(int n, double **A, double *ev, double **evec);
 
 void normalize(double *v, int n);
 
 void jacobi(double **A, double *eigvals, double **eigvecs, int n);
 
+int jacobi_tol(double **A, double *eigvals, double **eigvecs, int n,
+               double slack, int k);
+
+double grey_slack(int m, int n, double **A, double grey);
+
+void tridiagonal_eigen(int n, double *d, double *e, double **z);
+
+void symmetric_eigen(int n, double **A, double *ev, double **evec);
+
 double frobenius_norm(int m, int n, double **A);
 
 #endif
\ No newline at end of file
@@ -1,27 +1,19 @@
 #include "helper.h"
+#include "lra.h"
 #include <stdlib.h>
 #include <stdio.h>
 
-double **low_rank_approx(int m, int n, double ***svd, int k) {
-    if (!svd || !svd[0] || !svd[1] || !svd[2]) return NULL;
-    if (m <= 0 || n <= 0) return NULL;
-
-    int r = (m < n) ? m : n;
-    if (k <= 0) return NULL;
-    if (k > r) k = r; // cap k to rank
-
-    double **U = svd[0];
-    double **S = svd[1];
-    double **V = svd[2];
-
+/* Compute A_k = sum_{t=0..k-1} sigma_t * U[:,t] * V[:,t]^T, with sigma_t
+   taken from the vector S, or from the diagonal of Sfull if S is NULL */
+static double **reconstruct(int m, int n, double **U, const double *S,
+                            double **Sfull, double **V, int k) {
     double **Ak = (double **)malloc(m * sizeof(double *));
     for (int i = 0; i < m; ++i) {
         Ak[i] = (double *)calloc(n, sizeof(double));
     }
 
-    /* Compute A_k = sum_{t=0..k-1} sigma_t * U[:,t] * V[:,t]^T */
     for (int t = 0; t < k; ++t) {
-        double sigma = S[t][t];
+        double sigma = S ? S[t] : Sfull[t][t];
         if (sigma == 0.0) continue;
         for (int i = 0; i < m; ++i) {
             double u = U[i][t];
@@ -37,4 +29,22 @@ double **low_rank_approx(int m, int n, double ***svd, int k) {
     }
 
     return Ak;
-}
\ No newline at end of file
+}
+
+double **low_rank_approx_thin(thin_svd *s, int k) {
+    if (!s || !s->U || !s->S || !s->V) return NULL;
+    if (k <= 0) return NULL;
+    if (k > s->r) k = s->r; // cap k to the triplets we have
+    return reconstruct(s->m, s->n, s->U, s->S, NULL, s->V, k);
+}
+
+double **low_rank_approx(int m, int n, double ***svd, int k) {
+    if (!svd || !svd[0] || !svd[1] || !svd[2]) return NULL;
+    if (m <= 0 || n <= 0) return NULL;
+
+    int r = (m < n) ? m : n;
+    if (k <= 0) return NULL;
+    if (k > r) k = r; // cap k to rank
+
+    return reconstruct(m, n, svd[0], NULL, svd[1], svd[2], k);
+}
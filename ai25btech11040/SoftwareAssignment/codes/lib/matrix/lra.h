@@ -1,6 +1,10 @@
 #ifndef LRA_H
 #define LRA_H
 
+#include "svd.h"
+
+double **low_rank_approx_thin(thin_svd *s, int k);
+
 double **low_rank_approx(int m, int n, double ***svd, int k);
 
-#endif // LRA_H
\ No newline at end of file
+#endif // LRA_H
@@ -0,0 +1,278 @@
+// Coarse-to-fine SVD over an image pyramid. Each level averages 2 x 2 blocks
+// of the one below, so the leading singular vectors of a level are, up to
+// scale, the leading singular vectors of the finer level sampled at half the
+// resolution. Only the coarsest level gets a full (Jacobi) solve. Going back
+// down, V is interpolated to the finer columns and refined by block subspace
+// iteration on A^T A, which costs O(m n k) per step instead of O(n^3).
+
+#include "pyramid.h"
+#include "../png/readpng.h"
+#include "../png/savepng.h"
+#include "helper.h"
+#include "lra.h"
+#include "tsqr.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define PYRAMID_MIN 64  // smallest side of the coarsest level
+#define PYRAMID_EXTRA 8 // triplets kept beyond k, as in svd_warm()
+
+// 2 x 2 block averages of A (m x n), the last row/column alone if odd
+static double **downsample(int m, int n, double **A) {
+  int mc = (m + 1) / 2, nc = (n + 1) / 2;
+  double **C = (double **)malloc(mc * sizeof(double *));
+  for (int i = 0; i < mc; i++) {
+    C[i] = (double *)calloc(nc, sizeof(double));
+    int rows = (2 * i + 1 < m) ? 2 : 1;
+    for (int r = 0; r < rows; r++)
+      for (int j = 0; j < n; j++)
+        C[i][j / 2] += A[2 * i + r][j];
+    for (int j = 0; j < nc; j++)
+      C[i][j] /= rows * ((2 * j + 1 < n) ? 2 : 1);
+  }
+  return C;
+}
+
+// Q (nc x b) linearly interpolated to n rows: fine column j sits at
+// (j - 0.5) / 2 in coarse coordinates
+static double **upsample(int nc, int n, int b, double **Q) {
+  double **F = (double **)malloc(n * sizeof(double *));
+  for (int j = 0; j < n; j++) {
+    F[j] = (double *)malloc(b * sizeof(double));
+    double x = (j - 0.5) / 2.0;
+    if (x < 0.0)
+      x = 0.0;
+    if (x > nc - 1)
+      x = nc - 1;
+    int c = (int)x;
+    if (c > nc - 2)
+      c = (nc > 1) ? nc - 2 : 0;
+    double w = (nc > 1) ? x - c : 0.0;
+    for (int t = 0; t < b; t++)
+      F[j][t] = (1.0 - w) * Q[c][t] + ((nc > 1) ? w * Q[c + 1][t] : 0.0);
+  }
+  return F;
+}
+
+// A Q (m x b), row by row so that both A and Q are read in order
+static double **times(int m, int n, double **A, int b, double **Q) {
+  double **B = (double **)malloc(m * sizeof(double *));
+  for (int i = 0; i < m; i++) {
+    B[i] = (double *)calloc(b, sizeof(double));
+    for (int j = 0; j < n; j++) {
+      double a = A[i][j];
+      for (int t = 0; t < b; t++)
+        B[i][t] += a * Q[j][t];
+    }
+  }
+  return B;
+}
+
+// A^T B (n x b)
+static double **times_t(int m, int n, double **A, int b, double **B) {
+  double **Z = (double **)malloc(n * sizeof(double *));
+  for (int j = 0; j < n; j++)
+    Z[j] = (double *)calloc(b, sizeof(double));
+  for (int i = 0; i < m; i++)
+    for (int j = 0; j < n; j++) {
+      double a = A[i][j];
+      for (int t = 0; t < b; t++)
+        Z[j][t] += a * B[i][t];
+    }
+  return Z;
+}
+
+// Rayleigh-Ritz on the orthonormal columns of Q: with A Q = B and
+// B^T B = W diag(theta) W^T, the triplets are sqrt(theta), B W / sigma and
+// Q W, sorted by sigma
+static thin_svd *ritz(int m, int n, double **A, int b, double **Q) {
+  double **B = times(m, n, A, b, Q);
+  double **H = times_t(m, b, B, b, B);
+  double *theta = (double *)malloc(b * sizeof(double));
+  double **W = (double **)malloc(b * sizeof(double *));
+  for (int t = 0; t < b; t++)
+    W[t] = (double *)malloc(b * sizeof(double));
+  jacobi(H, theta, W, b);
+  free_matrix(b, H);
+
+  int *idx = (int *)malloc(b * sizeof(int));
+  for (int t = 0; t < b; t++) {
+    int j = t - 1;
+    while (j >= 0 && theta[idx[j]] < theta[t]) {
+      idx[j + 1] = idx[j];
+      j--;
+    }
+    idx[j + 1] = t;
+  }
+
+  thin_svd *s = (thin_svd *)malloc(sizeof(thin_svd));
+  s->m = m;
+  s->n = n;
+  s->r = b;
+  s->S = (double *)malloc(b * sizeof(double));
+  for (int t = 0; t < b; t++)
+    s->S[t] = (theta[idx[t]] > 0) ? sqrt(theta[idx[t]]) : 0.0;
+  s->V = (double **)malloc(n * sizeof(double *));
+  for (int j = 0; j < n; j++) {
+    s->V[j] = (double *)calloc(b, sizeof(double));
+    for (int c = 0; c < b; c++)
+      for (int t = 0; t < b; t++)
+        s->V[j][t] += Q[j][c] * W[c][idx[t]];
+  }
+  s->U = (double **)malloc(m * sizeof(double *));
+  for (int i = 0; i < m; i++) {
+    s->U[i] = (double *)calloc(b, sizeof(double));
+    for (int c = 0; c < b; c++)
+      for (int t = 0; t < b; t++)
+        s->U[i][t] += B[i][c] * W[c][idx[t]];
+    for (int t = 0; t < b; t++)
+      s->U[i][t] = (s->S[t] >= 1e-12) ? s->U[i][t] / s->S[t] : 0.0;
+  }
+  tsqr(m, b, s->U, NULL);
+  for (int t = 0; t < b; t++)
+    if (s->S[t] < 1e-12)
+      for (int i = 0; i < m; i++)
+        s->U[i][t] = 0.0;
+
+  free(idx);
+  free(theta);
+  free_matrix(b, W);
+  free_matrix(m, B);
+  return s;
+}
+
+thin_svd *svd_pyramid(int m, int n, double **A, int k, int iters, int *levels) {
+  if (!A || m <= 0 || n <= 0)
+    return NULL;
+  int r = (m < n) ? m : n;
+  int b = (k > 0 && k + PYRAMID_EXTRA < r) ? k + PYRAMID_EXTRA : r;
+  int least = (b > PYRAMID_MIN) ? b : PYRAMID_MIN;
+
+  // level 0 is A itself, each further level halves both sides
+  int cnt = 1, mc = m, nc = n;
+  while ((mc + 1) / 2 >= least && (nc + 1) / 2 >= least) {
+    mc = (mc + 1) / 2;
+    nc = (nc + 1) / 2;
+    cnt++;
+  }
+  if (levels)
+    *levels = cnt;
+  if (cnt == 1)
+    return svd_thin(m, n, A, b, 0.0, NULL);
+
+  int *lm = (int *)malloc(cnt * sizeof(int));
+  int *ln = (int *)malloc(cnt * sizeof(int));
+  double ***L = (double ***)malloc(cnt * sizeof(double **));
+  lm[0] = m;
+  ln[0] = n;
+  L[0] = A;
+  for (int l = 1; l < cnt; l++) {
+    L[l] = downsample(lm[l - 1], ln[l - 1], L[l - 1]);
+    lm[l] = (lm[l - 1] + 1) / 2;
+    ln[l] = (ln[l - 1] + 1) / 2;
+  }
+
+  int top = cnt - 1;
+  thin_svd *s = svd_thin(lm[top], ln[top], L[top], b, 0.0, NULL);
+  double **Q = s->V;
+  s->V = NULL;
+  free_thin_svd(s);
+
+  for (int l = top - 1; l >= 0; l--) {
+    double **F = upsample(ln[l + 1], ln[l], b, Q);
+    free_matrix(ln[l + 1], Q);
+    Q = F;
+    tsqr(ln[l], b, Q, NULL);
+    for (int it = 0; it < iters; it++) {
+      double **B = times(lm[l], ln[l], L[l], b, Q);
+      free_matrix(ln[l], Q);
+      Q = times_t(lm[l], ln[l], L[l], b, B);
+      free_matrix(lm[l], B);
+      tsqr(ln[l], b, Q, NULL);
+    }
+  }
+  s = ritz(m, n, A, b, Q);
+
+  free_matrix(n, Q);
+  for (int l = 1; l < cnt; l++)
+    free_matrix(lm[l], L[l]);
+  free(L);
+  free(lm);
+  free(ln);
+  return s;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// ||A - A_k|| with A_k truncated to integers, as in main.c
+static double error(int m, int n, int **array, thin_svd *s, int k,
+                    double ***A_k) {
+  *A_k = low_rank_approx_thin(s, k);
+  double err2 = 0.0;
+  for (int i = 0; i < m; i++)
+    for (int j = 0; j < n; j++) {
+      double d = array[i][j] - (int)(*A_k)[i][j];
+      err2 += d * d;
+    }
+  return sqrt(err2);
+}
+
+int run_pyramid(const char *src, int k, int iters) {
+  int ihdr[7];
+  int **array = readpng(src, ihdr);
+  if (!array) {
+    fprintf(stderr, "Failed to read PNG file %s\n", src);
+    return -1;
+  }
+  int m = ihdr[1], n = ihdr[0];
+  double **A = (double **)malloc(m * sizeof(double *));
+  for (int i = 0; i < m; i++) {
+    A[i] = (double *)malloc(n * sizeof(double));
+    for (int j = 0; j < n; j++)
+      A[i][j] = (double)array[i][j];
+  }
+
+  int levels;
+  double t0 = now_ms();
+  thin_svd *p = svd_pyramid(m, n, A, k, iters, &levels);
+  double pyramid_ms = now_ms() - t0;
+  t0 = now_ms();
+  thin_svd *d = svd_thin(m, n, A, k, 0.0, NULL);
+  double direct_ms = now_ms() - t0;
+
+  double **P_k, **D_k;
+  double pyramid_err = error(m, n, array, p, k, &P_k);
+  double direct_err = error(m, n, array, d, k, &D_k);
+  int mc = m, nc = n;
+  for (int l = 1; l < levels; l++) {
+    mc = (mc + 1) / 2;
+    nc = (nc + 1) / 2;
+  }
+  printf("Pyramid: %d levels (coarsest %d x %d), %d iterations per level: "
+         "%.2f ms\n",
+         levels, nc, mc, iters, pyramid_ms);
+  printf("Direct svd_thin(): %.2f ms\n", direct_ms);
+  printf("Frobenius norm of the difference between original and A_k: "
+         "%.5lf (direct %.5lf)\n",
+         pyramid_err, direct_err);
+  printf("Frobenius norm error per pixel: %.5lf (direct %.5lf)\n",
+         pyramid_err / (m * n), direct_err / (m * n));
+  int out[7] = {n, m, 8, 0, 0, 0, 0};
+  savepng_from("out.png", P_k, ihdr[2], out, 0);
+
+  for (int i = 0; i < m; i++)
+    free(array[i]);
+  free(array);
+  free_matrix(m, A);
+  free_matrix(m, P_k);
+  free_matrix(m, D_k);
+  free_thin_svd(p);
+  free_thin_svd(d);
+  return 0;
+}
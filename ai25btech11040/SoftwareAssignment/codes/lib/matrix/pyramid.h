@@ -0,0 +1,18 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "svd.h"
+
+// Coarse-to-fine economy SVD. A is halved in both directions until its
+// smaller side would drop below PYRAMID_MIN, the coarsest level is factored
+// by svd_thin(), and its right singular vectors are interpolated up one level
+// at a time and refined there by `iters` subspace iterations. Returns
+// k + PYRAMID_EXTRA triplets (at most min(m, n)); *levels (if not NULL) is set
+// to the number of levels, 1 meaning A was factored directly.
+thin_svd *svd_pyramid(int m, int n, double **A, int k, int iters, int *levels);
+
+// Compresses src at rank k with svd_pyramid() and with svd_thin(), reports
+// the time and error of both and writes the pyramid's A_k to out.png
+int run_pyramid(const char *src, int k, int iters);
+
+#endif // PYRAMID_H
@@ -0,0 +1,348 @@
+// Choosing k from the singular spectrum, computing only the triplets we need
+
+#include "rank.h"
+#include "helper.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+double target_metric(int mode, int m, int n, int k, double fro2, double kept,
+                     int maxval) {
+  // ||A - A_k||^2 = ||A||^2 - sum of the kept sigma^2
+  double err2 = fro2 - kept;
+  if (err2 < 0.0)
+    err2 = 0.0;
+  switch (mode) {
+  case TARGET_PSNR:
+    if (err2 == 0.0)
+      return HUGE_VAL;
+    return 10.0 * log10((double)maxval * maxval * m * n / err2);
+  case TARGET_ERROR:
+    return sqrt(err2);
+  case TARGET_ENERGY:
+    return fro2 > 0.0 ? kept / fro2 : 1.0;
+  case TARGET_RATIO:
+    return (double)m * n / ((double)k * (m + n + 1));
+  }
+  return 0.0;
+}
+
+static int target_met(int mode, double value, double target) {
+  if (mode == TARGET_ERROR)
+    return value <= target;
+  return value >= target;
+}
+
+// Smallest k meeting the target given the whole spectrum S (r values,
+// descending) of a matrix with ||A||^2 = fro2. For TARGET_RATIO it is the
+// largest k that still meets the ratio. *achieved gets the metric at k.
+int pick_rank(int mode, int m, int n, int r, const double *S, double fro2,
+              double target, int maxval, double *achieved) {
+  int k = r;
+  double kept = 0.0;
+  if (mode == TARGET_RATIO) {
+    k = target > 0.0 ? (int)((double)m * n / (target * (m + n + 1))) : r;
+    if (k < 1)
+      k = 1;
+    if (k > r)
+      k = r;
+    for (int t = 0; t < k; t++)
+      kept += S[t] * S[t];
+  } else {
+    for (int t = 0; t < r; t++) {
+      kept += S[t] * S[t];
+      if (target_met(mode, target_metric(mode, m, n, t + 1, fro2, kept, maxval),
+                     target)) {
+        k = t + 1;
+        break;
+      }
+    }
+  }
+  if (achieved)
+    *achieved = target_metric(mode, m, n, k, fro2, kept, maxval);
+  return k;
+}
+
+static double dot(int n, const double *a, const double *b) {
+  double s = 0.0;
+  for (int i = 0; i < n; i++)
+    s += a[i] * b[i];
+  return s;
+}
+
+// w = A^T * (A * x), without ever forming A^T * A
+static void apply_gram(int m, int n, double **A, const double *x, double *tmp,
+                       double *w) {
+  for (int i = 0; i < m; i++)
+    tmp[i] = dot(n, A[i], x);
+  for (int j = 0; j < n; j++)
+    w[j] = 0.0;
+  for (int i = 0; i < m; i++) {
+    double t = tmp[i];
+    for (int j = 0; j < n; j++)
+      w[j] += A[i][j] * t;
+  }
+}
+
+// Fill v with a pseudo random vector orthogonal to Q[0..cnt-1], normalized.
+// Returns its norm before normalization (0 if Q already spans everything).
+static double random_start(int n, double *v, double **Q, int cnt,
+                           unsigned long *seed) {
+  for (int i = 0; i < n; i++) {
+    *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+    v[i] = (double)(*seed >> 11) / 9007199254740992.0 - 0.5;
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < cnt; i++) {
+      double c = dot(n, v, Q[i]);
+      for (int j = 0; j < n; j++)
+        v[j] -= c * Q[i][j];
+    }
+  }
+  double norm = sqrt(dot(n, v, v));
+  if (norm > 1e-10) {
+    for (int i = 0; i < n; i++)
+      v[i] /= norm;
+  } else {
+    norm = 0.0;
+  }
+  return norm;
+}
+
+// Rayleigh-Ritz on the Lanczos tridiagonal T (dim x dim). Ritz values are
+// returned in theta sorted in descending order, idx maps them to columns of Z.
+static void ritz(int dim, const double *alpha, const double *beta,
+                 double *theta, int *idx, double **Z) {
+  double *e = (double *)malloc(dim * sizeof(double));
+  for (int i = 0; i < dim; i++) {
+    theta[i] = alpha[i];
+    e[i] = (i + 1 < dim) ? beta[i] : 0.0;
+    for (int j = 0; j < dim; j++)
+      Z[i][j] = (i == j) ? 1.0 : 0.0;
+  }
+  tridiagonal_eigen(dim, theta, e, Z);
+  free(e);
+
+  for (int i = 0; i < dim; i++)
+    idx[i] = i;
+  for (int i = 1; i < dim; i++) {
+    int t = idx[i];
+    int j = i - 1;
+    while (j >= 0 && theta[idx[j]] < theta[t]) {
+      idx[j + 1] = idx[j];
+      j--;
+    }
+    idx[j + 1] = t;
+  }
+  double *sorted = (double *)malloc(dim * sizeof(double));
+  for (int i = 0; i < dim; i++)
+    sorted[i] = theta[idx[i]];
+  for (int i = 0; i < dim; i++)
+    theta[i] = sorted[i];
+  free(sorted);
+}
+
+/*
+ * Lanczos with full reorthogonalization on A^T A. Every few steps the Ritz
+ * values are checked against the target. Since A_k = U_k S_k V_k^T = A V_k
+ * V_k^T for any orthonormal V_k with U_k = A V_k / S_k, the error of the
+ * returned approximation is exactly ||A||^2 - sum of the kept Ritz values, so
+ * the target is met as soon as that sum allows it. We additionally wait for
+ * the kept Ritz pairs to converge so that k is not larger than necessary.
+ * With grey > 0 a Ritz pair counts as converged once its residual can no
+ * longer move a pixel by grey levels (see grey_slack() in helper.c).
+ *
+ * Returns the k triplets as a thin_svd. *reached is 0 if no k meets the
+ * target, in which case every triplet found is returned.
+ */
+thin_svd *svd_target(int m, int n, double **A, int mode, double target,
+                     int maxval, double grey, int *k_out, double *achieved,
+                     int *reached) {
+  if (!A || m <= 0 || n <= 0)
+    return NULL;
+  int r = (m < n) ? m : n;
+
+  double fro2 = 0.0;
+  for (int i = 0; i < m; i++)
+    fro2 += dot(n, A[i], A[i]);
+
+  int kfix = 0;
+  if (mode == TARGET_RATIO) {
+    if (target <= 0.0)
+      return NULL;
+    kfix = (int)((double)m * n / (target * (m + n + 1)));
+    if (kfix < 1)
+      kfix = 1;
+    if (kfix > r)
+      kfix = r;
+  }
+
+  const int block = 8; // Lanczos steps between target checks
+  const double tol = 1e-8; // Ritz residual, relative to the largest
+  double slack = grey_slack(m, n, A, grey);
+  double **Q = (double **)calloc(n, sizeof(double *));
+  double *alpha = (double *)malloc(n * sizeof(double));
+  double *beta = (double *)malloc(n * sizeof(double));
+  double *theta = (double *)malloc(n * sizeof(double));
+  int *idx = (int *)malloc(n * sizeof(int));
+  double *tmp = (double *)malloc(m * sizeof(double));
+  double **Z = NULL;
+  int zdim = 0;
+  unsigned long seed = 20251030UL;
+
+  Q[0] = (double *)malloc(n * sizeof(double));
+  random_start(n, Q[0], Q, 0, &seed);
+
+  int k = 0, dim = 0, met = 1;
+  for (int j = 0;; j++) {
+    double *w = (double *)malloc(n * sizeof(double));
+    apply_gram(m, n, A, Q[j], tmp, w);
+    alpha[j] = dot(n, w, Q[j]);
+    for (int pass = 0; pass < 2; pass++) {
+      for (int i = 0; i <= j; i++) {
+        double c = dot(n, w, Q[i]);
+        for (int t = 0; t < n; t++)
+          w[t] -= c * Q[i][t];
+      }
+    }
+    beta[j] = sqrt(dot(n, w, w));
+    dim = j + 1;
+    int breakdown = beta[j] <= 1e-12 * fro2;
+    if (breakdown)
+      beta[j] = 0.0; // T decouples here
+    int last = (dim == n);
+
+    if (dim % block == 0 || breakdown || last) {
+      for (int i = 0; i < zdim; i++)
+        free(Z[i]);
+      free(Z);
+      Z = (double **)malloc(dim * sizeof(double *));
+      for (int i = 0; i < dim; i++)
+        Z[i] = (double *)malloc(dim * sizeof(double));
+      zdim = dim;
+      ritz(dim, alpha, beta, theta, idx, Z);
+
+      if (kfix) {
+        k = (kfix < dim) ? kfix : dim;
+      } else {
+        double kept = 0.0;
+        k = 0;
+        for (int i = 0; i < dim && i < r; i++) {
+          kept += (theta[i] > 0.0) ? theta[i] : 0.0;
+          if (target_met(mode,
+                         target_metric(mode, m, n, i + 1, fro2, kept, maxval),
+                         target)) {
+            k = i + 1;
+            break;
+          }
+        }
+      }
+
+      int converged = k > 0 && (!kfix || dim >= kfix);
+      for (int i = 0; converged && i < k; i++) {
+        double res = beta[j] * fabs(Z[j][idx[i]]);
+        if (slack > 0.0) {
+          // the Ritz vector is within res / gap of the true one
+          double gap = HUGE_VAL;
+          if (i > 0)
+            gap = theta[i - 1] - theta[i];
+          if (i + 1 < dim && theta[i] - theta[i + 1] < gap)
+            gap = theta[i] - theta[i + 1];
+          if (res > slack * gap)
+            converged = 0;
+        } else if (res > tol * theta[0]) {
+          converged = 0;
+        }
+      }
+      if (converged || last) {
+        if (k == 0) {
+          k = (dim < r) ? dim : r; // target unreachable, keep everything
+          met = 0;
+        }
+        free(w);
+        break;
+      }
+    }
+
+    Q[j + 1] = (double *)malloc(n * sizeof(double));
+    if (breakdown) {
+      // invariant subspace found, continue the Krylov space from a fresh
+      // vector orthogonal to it
+      if (random_start(n, Q[j + 1], Q, j + 1, &seed) == 0.0) {
+        if (k == 0) {
+          k = (dim < r) ? dim : r;
+          met = 0;
+        }
+        free(Q[j + 1]);
+        Q[j + 1] = NULL;
+        free(w);
+        break;
+      }
+    } else {
+      for (int t = 0; t < n; t++)
+        Q[j + 1][t] = w[t] / beta[j];
+    }
+    free(w);
+  }
+
+  thin_svd *ret = (thin_svd *)malloc(sizeof(thin_svd));
+  ret->m = m;
+  ret->n = n;
+  ret->r = k;
+  // V = Q * Z restricted to the top k Ritz vectors
+  ret->V = (double **)malloc(n * sizeof(double *));
+  for (int row = 0; row < n; row++)
+    ret->V[row] = (double *)calloc(k, sizeof(double));
+  for (int i = 0; i < dim; i++) {
+    for (int t = 0; t < k; t++) {
+      double z = Z[i][idx[t]];
+      for (int row = 0; row < n; row++)
+        ret->V[row][t] += Q[i][row] * z;
+    }
+  }
+
+  double kept = 0.0;
+  ret->S = (double *)malloc(k * sizeof(double));
+  for (int i = 0; i < k; i++) {
+    ret->S[i] = (theta[i] > 0.0) ? sqrt(theta[i]) : 0.0;
+    kept += ret->S[i] * ret->S[i];
+  }
+
+  // u_t = A v_t / sigma_t
+  ret->U = (double **)malloc(m * sizeof(double *));
+  for (int row = 0; row < m; row++) {
+    ret->U[row] = (double *)malloc(k * sizeof(double));
+    for (int t = 0; t < k; t++) {
+      double sigma = ret->S[t];
+      double s = 0.0;
+      if (sigma > 1e-12) {
+        for (int c = 0; c < n; c++)
+          s += A[row][c] * ret->V[c][t];
+        s /= sigma;
+      }
+      ret->U[row][t] = s;
+    }
+  }
+
+  *k_out = k;
+  double value = target_metric(mode, m, n, k, fro2, kept, maxval);
+  if (achieved)
+    *achieved = value;
+  if (kfix)
+    met = target_met(mode, value, target); // not at k = 1 for a huge ratio
+  if (reached)
+    *reached = met;
+
+  for (int i = 0; i < n; i++)
+    free(Q[i]);
+  free(Q);
+  for (int i = 0; i < zdim; i++)
+    free(Z[i]);
+  free(Z);
+  free(alpha);
+  free(beta);
+  free(theta);
+  free(idx);
+  free(tmp);
+  return ret;
+}
@@ -0,0 +1,22 @@
+#ifndef RANK_H
+#define RANK_H
+
+#include "svd.h"
+
+// Quantities that can be used to pick k automatically
+#define TARGET_PSNR 0   // PSNR of A_k in dB, at least
+#define TARGET_ERROR 1  // Frobenius norm of A - A_k, at most
+#define TARGET_ENERGY 2 // fraction of sum(sigma^2) kept, at least
+#define TARGET_RATIO 3  // m*n / (k*(m+n+1)) storage ratio, at least
+
+double target_metric(int mode, int m, int n, int k, double fro2, double kept,
+                     int maxval);
+
+int pick_rank(int mode, int m, int n, int r, const double *S, double fro2,
+              double target, int maxval, double *achieved);
+
+thin_svd *svd_target(int m, int n, double **A, int mode, double target,
+                     int maxval, double grey, int *k_out, double *achieved,
+                     int *reached);
+
+#endif // RANK_H
@@ -0,0 +1,395 @@
+// Single-pass rank-k SVD, updated one row at a time (Brand's incremental SVD)
+//
+// With A ~ U diag(S) V^T for the rows seen so far, a new row a splits into its
+// coordinates b in the basis V0 of the row space kept so far and a residual
+// rho * j orthogonal to it. Then
+//
+//   [ A ]   [ U 0 ] [ diag(S) Vp^T   0  ] [ V0 j ]^T
+//   [ a ] = [ 0 1 ] [      b^T      rho ]
+//
+// and only the small core matrix in the middle needs an SVD. Its singular
+// vectors rotate the factors, which are kept as products U = U0 Up and
+// V = V0 Vp so that the big m x k and n x 2k arrays are only ever appended to,
+// never rewritten on every row. Rounding slowly spoils the orthogonality of
+// U and V, so every REORTH_EVERY rows both are re-orthogonalized.
+
+#include "stream.h"
+#include "helper.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REORTH_EVERY 128
+
+static double **zeros(int m, int n) {
+  double **A = (double **)malloc(m * sizeof(double *));
+  for (int i = 0; i < m; i++)
+    A[i] = (double *)calloc(n, sizeof(double));
+  return A;
+}
+
+static void identity(int n, double **A) {
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < n; j++)
+      A[i][j] = (i == j) ? 1.0 : 0.0;
+}
+
+// SVD of the small p x q matrix M: sv (p) descending, Uc (p x p) the full set
+// of left singular vectors, Vc (q x cnt) the right ones for the cnt singular
+// values that are not negligible. Returns cnt.
+static int core_svd(int p, int q, double **M, double *sv, double **Uc,
+                    double **Vc) {
+  double **G = zeros(p, p), **E = zeros(p, p);
+  double *ev = (double *)malloc(p * sizeof(double));
+  int *idx = (int *)malloc(p * sizeof(int));
+  for (int i = 0; i < p; i++)
+    for (int j = 0; j <= i; j++) {
+      double s = 0.0;
+      for (int t = 0; t < q; t++)
+        s += M[i][t] * M[j][t];
+      G[i][j] = G[j][i] = s;
+    }
+  symmetric_eigen(p, G, ev, E);
+  for (int i = 0; i < p; i++) {
+    int j = i - 1;
+    while (j >= 0 && ev[idx[j]] < ev[i]) {
+      idx[j + 1] = idx[j];
+      j--;
+    }
+    idx[j + 1] = i;
+  }
+
+  int cnt = 0;
+  for (int t = 0; t < p; t++) {
+    sv[t] = ev[idx[t]] > 0 ? sqrt(ev[idx[t]]) : 0.0;
+    for (int i = 0; i < p; i++)
+      Uc[i][t] = E[i][idx[t]];
+    if (sv[t] > 1e-8 * sv[0] && t < q)
+      cnt = t + 1;
+  }
+  // v_t = M^T u_t / sigma_t
+  for (int t = 0; t < cnt; t++)
+    for (int j = 0; j < q; j++) {
+      double s = 0.0;
+      for (int i = 0; i < p; i++)
+        s += M[i][j] * Uc[i][t];
+      Vc[j][t] = s / sv[t];
+    }
+
+  free_matrix(p, G);
+  free_matrix(p, E);
+  free(ev);
+  free(idx);
+  return cnt;
+}
+
+// Rows of A (m x p) replaced by their product with B (p x q), columns past q
+// cleared up to width
+static void rotate_rows(int m, int p, int q, int width, double **A,
+                        double **B) {
+  double *tmp = (double *)malloc((q > 0 ? q : 1) * sizeof(double));
+  for (int i = 0; i < m; i++) {
+    for (int t = 0; t < q; t++) {
+      double s = 0.0;
+      for (int c = 0; c < p; c++)
+        s += A[i][c] * B[c][t];
+      tmp[t] = s;
+    }
+    memcpy(A[i], tmp, q * sizeof(double));
+    for (int t = q; t < width; t++)
+      A[i][t] = 0.0;
+  }
+  free(tmp);
+}
+
+// Modified Gram-Schmidt on the first r columns of A (m x r): A = Q R, Q
+// written over A, R (r x r) returned upper triangular
+static void mgs(int m, int r, double **A, double **R) {
+  for (int t = 0; t < r; t++) {
+    for (int j = 0; j < r; j++)
+      R[j][t] = 0.0;
+    for (int j = 0; j < t; j++) {
+      double dot = 0.0;
+      for (int i = 0; i < m; i++)
+        dot += A[i][j] * A[i][t];
+      for (int i = 0; i < m; i++)
+        A[i][t] -= dot * A[i][j];
+      R[j][t] = dot;
+    }
+    double norm = 0.0;
+    for (int i = 0; i < m; i++)
+      norm += A[i][t] * A[i][t];
+    norm = sqrt(norm);
+    R[t][t] = norm;
+    for (int i = 0; i < m; i++)
+      A[i][t] = norm > 1e-300 ? A[i][t] / norm : 0.0;
+  }
+}
+
+stream_svd *stream_svd_new(int n, int k) {
+  if (n <= 0 || k <= 0)
+    return NULL;
+  if (k > n)
+    k = n;
+  stream_svd *s = (stream_svd *)malloc(sizeof(stream_svd));
+  s->n = n;
+  s->k = k;
+  s->m = 0;
+  s->r = 0;
+  s->cap = 64;
+  s->U0 = (double **)malloc(s->cap * sizeof(double *));
+  s->Up = zeros(k, k);
+  s->Upi = zeros(k, k);
+  s->S = (double *)calloc(k, sizeof(double));
+  s->c = 0;
+  s->V0 = zeros(n, 2 * k);
+  s->Vp = zeros(2 * k + 1, k);
+  s->fro2 = 0.0;
+  s->since_orth = 0;
+  return s;
+}
+
+// V0 <- V0 Vp, so that V0 has exactly the r columns of V again
+static void fold_v(stream_svd *s) {
+  rotate_rows(s->n, s->c, s->r, 2 * s->k, s->V0, s->Vp);
+  for (int i = 0; i < 2 * s->k + 1; i++)
+    for (int t = 0; t < s->k; t++)
+      s->Vp[i][t] = (i == t && t < s->r) ? 1.0 : 0.0;
+  s->c = s->r;
+}
+
+// U0 <- U0 Up, Up = Up^-1 = I
+static void fold_u(stream_svd *s) {
+  rotate_rows(s->m, s->r, s->r, s->k, s->U0, s->Up);
+  identity(s->k, s->Up);
+  identity(s->k, s->Upi);
+}
+
+// Restore orthonormal columns in U and V: with U = Qu Ru and V = Qv Rv the
+// approximation is Qu (Ru diag(S) Rv^T) Qv^T, and the SVD of the r x r middle
+// factor gives the new singular triplets.
+static void reorthogonalize(stream_svd *s) {
+  int r = s->r;
+  if (r == 0)
+    return;
+  fold_u(s);
+  fold_v(s);
+  double **Ru = zeros(r, r), **Rv = zeros(r, r), **C = zeros(r, r);
+  double **Uc = zeros(r, r), **Vc = zeros(r, r);
+  mgs(s->m, r, s->U0, Ru);
+  mgs(s->n, r, s->V0, Rv);
+  for (int i = 0; i < r; i++)
+    for (int j = 0; j < r; j++) {
+      double sum = 0.0;
+      for (int t = (i > j ? i : j); t < r; t++)
+        sum += Ru[i][t] * s->S[t] * Rv[j][t];
+      C[i][j] = sum;
+    }
+  int cnt = core_svd(r, r, C, s->S, Uc, Vc);
+  rotate_rows(s->m, r, cnt, s->k, s->U0, Uc);
+  rotate_rows(s->n, r, cnt, 2 * s->k, s->V0, Vc);
+  for (int t = cnt; t < s->k; t++)
+    s->S[t] = 0.0;
+  s->r = s->c = cnt;
+  for (int i = 0; i < 2 * s->k + 1; i++)
+    for (int t = 0; t < s->k; t++)
+      s->Vp[i][t] = (i == t && t < cnt) ? 1.0 : 0.0;
+  s->since_orth = 0;
+  free_matrix(r, Ru);
+  free_matrix(r, Rv);
+  free_matrix(r, C);
+  free_matrix(r, Uc);
+  free_matrix(r, Vc);
+}
+
+void stream_svd_append(stream_svd *s, const double *a) {
+  int n = s->n, k = s->k, r = s->r, c = s->c;
+  double *b = (double *)calloc(c + 1, sizeof(double));
+  double *d = (double *)malloc((c + 1) * sizeof(double));
+  double *res = (double *)malloc(n * sizeof(double));
+
+  // b = V0^T a and res = a - V0 b, done twice so that res really is
+  // orthogonal to V0
+  double anorm = 0.0;
+  for (int j = 0; j < n; j++) {
+    res[j] = a[j];
+    anorm += a[j] * a[j];
+  }
+  s->fro2 += anorm;
+  anorm = sqrt(anorm);
+  for (int pass = 0; pass < 2; pass++) {
+    memset(d, 0, c * sizeof(double));
+    for (int j = 0; j < n; j++)
+      for (int t = 0; t < c; t++)
+        d[t] += s->V0[j][t] * res[j];
+    for (int j = 0; j < n; j++) {
+      double sum = 0.0;
+      for (int t = 0; t < c; t++)
+        sum += s->V0[j][t] * d[t];
+      res[j] -= sum;
+    }
+    for (int t = 0; t < c; t++)
+      b[t] += d[t];
+  }
+  double rho = 0.0;
+  for (int j = 0; j < n; j++)
+    rho += res[j] * res[j];
+  rho = sqrt(rho);
+  if (rho <= 1e-10 * anorm || c == n)
+    rho = 0.0; // a already lies in the span of V0
+
+  // core matrix, (r + 1) x cc, in the basis [V0 j]
+  int p = r + 1, cc = c + (rho > 0.0);
+  double **M = zeros(p, cc), **Uc = zeros(p, p), **Vc = zeros(cc, p);
+  double *sv = (double *)malloc(p * sizeof(double));
+  for (int i = 0; i < r; i++)
+    for (int t = 0; t < c; t++)
+      M[i][t] = s->S[i] * s->Vp[t][i];
+  for (int t = 0; t < c; t++)
+    M[r][t] = b[t];
+  if (rho > 0.0)
+    M[r][c] = rho;
+  int cnt = core_svd(p, cc, M, sv, Uc, Vc);
+  int rn = cnt < k ? cnt : k;
+
+  // V = [V0 j] Vc
+  if (rho > 0.0) {
+    for (int j = 0; j < n; j++)
+      s->V0[j][c] = res[j] / rho;
+    s->c = ++c;
+  }
+  for (int i = 0; i < c; i++)
+    for (int t = 0; t < k; t++)
+      s->Vp[i][t] = t < rn ? Vc[i][t] : 0.0;
+  for (int t = 0; t < k; t++)
+    s->S[t] = t < rn ? sv[t] : 0.0;
+
+  // U = [U0 Up 0; 0 1] Uc, folding the rotation into Up and adding one row
+  // to U0
+  if (s->m == s->cap) {
+    s->cap *= 2;
+    s->U0 = (double **)realloc(s->U0, s->cap * sizeof(double *));
+  }
+  double *row = (double *)calloc(k + 1, sizeof(double));
+  s->U0[s->m] = row;
+  double denom = 0.0;
+  if (rn == r) {
+    denom = 1.0;
+    for (int t = 0; t < r; t++)
+      denom -= Uc[r][t] * Uc[r][t];
+  }
+  if (rn == r + 1) {
+    // the rank grows: U0 gets a new column, which is e_r
+    double **Up = zeros(p, p), **Upi = zeros(p, p);
+    for (int i = 0; i < p; i++)
+      for (int j = 0; j < p; j++) {
+        double sum = 0.0, sumi = 0.0;
+        for (int t = 0; t < r; t++) {
+          sum += (i < r ? s->Up[i][t] : 0.0) * Uc[t][j];
+          sumi += Uc[t][i] * (j < r ? s->Upi[t][j] : 0.0);
+        }
+        Up[i][j] = (i < r) ? sum : Uc[r][j];
+        Upi[i][j] = (j < r) ? sumi : Uc[r][i];
+      }
+    for (int i = 0; i < p; i++) {
+      memcpy(s->Up[i], Up[i], p * sizeof(double));
+      memcpy(s->Upi[i], Upi[i], p * sizeof(double));
+    }
+    free_matrix(p, Up);
+    free_matrix(p, Upi);
+    row[r] = 1.0;
+    s->m++;
+  } else if (rn == r && denom > 1e-6) {
+    // the rank stays at r: Up <- Up Q11 with Q11 = Uc[0:r, 0:r], and the new
+    // row of U0 is q Q11^-1 Up^-1 with q = Uc[r, 0:r]. Since Uc is orthogonal,
+    // Q11^T Q11 = I - q^T q and so Q11^-1 = (I + q^T q / (1 - q q^T)) Q11^T.
+    double **Up = zeros(r, r), **Qi = zeros(r, r), **Upi = zeros(r, r);
+    for (int i = 0; i < r; i++)
+      for (int j = 0; j < r; j++) {
+        double sum = 0.0;
+        for (int t = 0; t < r; t++)
+          sum += s->Up[i][t] * Uc[t][j];
+        Up[i][j] = sum;
+        sum = Uc[j][i];
+        for (int t = 0; t < r; t++)
+          sum += Uc[r][i] * Uc[r][t] * Uc[j][t] / denom;
+        Qi[i][j] = sum;
+      }
+    for (int i = 0; i < r; i++)
+      for (int j = 0; j < r; j++) {
+        double sum = 0.0;
+        for (int t = 0; t < r; t++)
+          sum += Qi[i][t] * s->Upi[t][j];
+        Upi[i][j] = sum;
+      }
+    for (int i = 0; i < r; i++) {
+      memcpy(s->Up[i], Up[i], r * sizeof(double));
+      memcpy(s->Upi[i], Upi[i], r * sizeof(double));
+    }
+    for (int t = 0; t < r; t++) {
+      double sum = 0.0;
+      for (int i = 0; i < r; i++)
+        sum += Uc[r][i] * Upi[i][t];
+      row[t] = sum;
+    }
+    free_matrix(r, Up);
+    free_matrix(r, Qi);
+    free_matrix(r, Upi);
+    s->m++;
+  } else {
+    // Q11 is (nearly) singular or the rank dropped: apply the rotation to
+    // U0 directly, O(m k^2) but rare
+    fold_u(s);
+    row[r] = 1.0;
+    s->m++;
+    rotate_rows(s->m, p, rn, k + 1, s->U0, Uc);
+  }
+  s->r = rn;
+
+  // make room for the next residual direction
+  if (s->c >= 2 * k)
+    fold_v(s);
+  if (++s->since_orth >= REORTH_EVERY)
+    reorthogonalize(s);
+
+  free_matrix(p, M);
+  free_matrix(p, Uc);
+  free_matrix(cc, Vc);
+  free(sv);
+  free(b);
+  free(d);
+  free(res);
+}
+
+// Explicit factors U = U0 Up (m x r) and V = V0 Vp (n x r); s is freed
+thin_svd *stream_svd_finish(stream_svd *s) {
+  if (!s)
+    return NULL;
+  reorthogonalize(s);
+  int r = s->r;
+  thin_svd *ret = (thin_svd *)malloc(sizeof(thin_svd));
+  ret->m = s->m;
+  ret->n = s->n;
+  ret->r = r;
+  ret->S = (double *)malloc((r > 0 ? r : 1) * sizeof(double));
+  memcpy(ret->S, s->S, r * sizeof(double));
+  ret->U = (double **)malloc((s->m > 0 ? s->m : 1) * sizeof(double *));
+  for (int i = 0; i < s->m; i++) {
+    ret->U[i] = (double *)malloc((r > 0 ? r : 1) * sizeof(double));
+    memcpy(ret->U[i], s->U0[i], r * sizeof(double));
+  }
+  ret->V = (double **)malloc(s->n * sizeof(double *));
+  for (int j = 0; j < s->n; j++) {
+    ret->V[j] = (double *)malloc((r > 0 ? r : 1) * sizeof(double));
+    memcpy(ret->V[j], s->V0[j], r * sizeof(double));
+  }
+
+  free_matrix(s->m, s->U0);
+  free_matrix(s->k, s->Up);
+  free_matrix(s->k, s->Upi);
+  free_matrix(s->n, s->V0);
+  free_matrix(2 * s->k + 1, s->Vp);
+  free(s->S);
+  free(s);
+  return ret;
+}
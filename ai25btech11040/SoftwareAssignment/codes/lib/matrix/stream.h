@@ -0,0 +1,29 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "svd.h"
+
+// Rank-k SVD of a matrix that arrives one row at a time. Only the factors are
+// kept, O((m + n) k) memory however many rows are appended.
+typedef struct {
+  int n, k;     // row length, rank kept
+  int m, r;     // rows appended so far, current rank (r <= k)
+  int cap;      // rows allocated in U0
+  double **U0;  // m x k (+1 spare column), U = U0 * Up
+  double **Up;  // k x k
+  double **Upi; // inverse of Up
+  double *S;    // k singular values, descending
+  int c;        // columns of V0 in use (r <= c <= 2k)
+  double **V0;  // n x 2k with orthonormal columns, V = V0 * Vp
+  double **Vp;  // 2k x k
+  double fro2;  // squared Frobenius norm of everything appended
+  int since_orth; // rows since the last re-orthogonalization
+} stream_svd;
+
+stream_svd *stream_svd_new(int n, int k);
+
+void stream_svd_append(stream_svd *s, const double *a);
+
+thin_svd *stream_svd_finish(stream_svd *s);
+
+#endif // STREAM_H
@@ -2,10 +2,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include "gram.h"
 #include "helper.h"
+#include "svd.h"
+#include "tsqr.h"
 #include <math.h>
 
-double *** svd(int m, int n, double **A) {
+// Full SVD through the eigenvectors of A^T A (n x n)
+static double *** svd_ata(int m, int n, double **A, double grey, int k, int *iters) {
     // Placeholder for SVD implementation
     // This function should compute the SVD of matrix A (m x n)
     // and return matrices U, S, and V as a 3D array.
@@ -16,9 +20,8 @@ double *** svd(int m, int n, double **A) {
     ret[2] = NULL; // V: nxn
 
     // We shall follow the eigenvaluedecomposition method for SVD
-    // Find A^T * A
-    double ** at = transpose(m, n, A);
-    double ** at_a = multiply(n, m, at, m, n, A);
+    // Find A^T * A (exactly, in integers, for 8-bit images; see gram.c)
+    double ** at_a = gram_ata(m, n, A);
 
     // Compute eigenvalues and eigenvectors of A^T * A
     // We will get n eigenvalues and n eigenvectors
@@ -27,7 +30,8 @@ double *** svd(int m, int n, double **A) {
     for (int i = 0; i < n; i++) {
         evec[i] = (double *)malloc(n * sizeof(double));
     }
-    eigen_decomposition(n, at_a, ev, evec);
+    int rotations = jacobi_tol(at_a, ev, evec, n, grey_slack(m, n, A, grey), k);
+    if (iters) *iters = rotations;
 
     //Sort eigenvalues and eigenvectors according to eigenvalues
     for (int i = 0; i < n - 1; i++) {
@@ -97,26 +101,9 @@ double *** svd(int m, int n, double **A) {
         }
     }
 
-    // Orthonormalize the first r columns (modified Gram-Schmidt)
-    for (int i = 0; i < r; i++) {
-        // subtract projections onto previous columns
-        for (int j = 0; j < i; j++) {
-            double dot = 0.0;
-            for (int row = 0; row < m; row++) dot += ret[0][row][j] * ret[0][row][i];
-            for (int row = 0; row < m; row++) ret[0][row][i] -= dot * ret[0][row][j];
-        }
-        // normalize
-        double norm = 0.0;
-        for (int row = 0; row < m; row++) norm += ret[0][row][i] * ret[0][row][i];
-        norm = sqrt(norm);
-        if (norm < eps) {
-            // fallback: make a canonical unit vector at position i (if possible)
-            for (int row = 0; row < m; row++) ret[0][row][i] = 0.0;
-            if (i < m) ret[0][i][i] = 1.0;
-        } else {
-            for (int row = 0; row < m; row++) ret[0][row][i] /= norm;
-        }
-    }
+    // Orthonormalize the first r columns (TSQR, see tsqr.c). Columns with a
+    // zero sigma come out as unit vectors orthogonal to the others.
+    tsqr(m, r, ret[0], NULL);
 
     // Complete U to an orthonormal m x m matrix using Gram-Schmidt on standard basis seeds
     for (int col = r; col < m; col++) {
@@ -193,6 +180,276 @@ double *** svd(int m, int n, double **A) {
     return ret;
 }
 
+// grey: accuracy target in output grey levels for the eigensolver (0 for the
+// strict default) when truncating to rank k (0 if unknown), iters: if not NULL
+// receives the number of Jacobi rotations. The eigenproblem is solved for the
+// smaller of A^T A and A A^T.
+double *** svd_tol(int m, int n, double **A, double grey, int k, int *iters) {
+    if (m >= n) return svd_ata(m, n, A, grey, k, iters);
+
+    // A^T = V S^T U^T, so factoring A^T through its Gram matrix A A^T
+    // (m x m) gives U and V with their roles swapped
+    double **at = transpose(m, n, A);
+    double ***t = svd_ata(n, m, at, grey, k, iters);
+    free_matrix(n, at);
+    double **S = (double **)malloc(m * sizeof(double *));
+    for (int i = 0; i < m; i++) {
+        S[i] = (double *)malloc(n * sizeof(double));
+        for (int j = 0; j < n; j++) S[i][j] = t[1][j][i];
+    }
+    free_matrix(n, t[1]);
+    double **U = t[2];
+    t[2] = t[0];
+    t[0] = U;
+    t[1] = S;
+    return t;
+}
+
+double *** svd(int m, int n, double **A) {
+    return svd_tol(m, n, A, 0.0, 0, NULL);
+}
+
+// Build the first r singular triplets from cnt eigenpairs (ev, evec) of
+// A^T A, evec (n x cnt) holding the eigenvectors as columns in any order.
+static thin_svd *thin_from_eigen(int m, int n, double **A, int r, int cnt,
+                                 double *ev, double **evec) {
+    // order of the eigenvalues, largest first
+    int *idx = (int *)malloc(cnt * sizeof(int));
+    for (int i = 0; i < cnt; i++) {
+        int j = i - 1;
+        while (j >= 0 && ev[idx[j]] < ev[i]) {
+            idx[j + 1] = idx[j];
+            j--;
+        }
+        idx[j + 1] = i;
+    }
+
+    thin_svd *ret = (thin_svd *)malloc(sizeof(thin_svd));
+    ret->m = m;
+    ret->n = n;
+    ret->r = r;
+    ret->S = (double *)malloc(r * sizeof(double));
+    for (int t = 0; t < r; t++)
+        ret->S[t] = (ev[idx[t]] > 0) ? sqrt(ev[idx[t]]) : 0.0;
+    ret->V = (double **)malloc(n * sizeof(double *));
+    for (int i = 0; i < n; i++) {
+        ret->V[i] = (double *)malloc(r * sizeof(double));
+        for (int t = 0; t < r; t++)
+            ret->V[i][t] = evec[i][idx[t]];
+    }
+    free(idx);
+
+    // u_t = A v_t / sigma_t, then orthonormalized by TSQR (tsqr.c)
+    double eps = 1e-12;
+    ret->U = (double **)malloc(m * sizeof(double *));
+    for (int i = 0; i < m; i++) {
+        ret->U[i] = (double *)malloc(r * sizeof(double));
+        for (int t = 0; t < r; t++) {
+            double sigma = ret->S[t], s = 0.0;
+            if (sigma >= eps) {
+                for (int c = 0; c < n; c++) s += A[i][c] * ret->V[c][t];
+                s /= sigma;
+            }
+            ret->U[i][t] = s;
+        }
+    }
+    tsqr(m, r, ret->U, NULL);
+    for (int t = 0; t < r; t++) {
+        if (ret->S[t] < eps) {
+            // sigma is zero here, so this column does not contribute to A_k
+            for (int row = 0; row < m; row++) ret->U[row][t] = 0.0;
+        }
+    }
+    return ret;
+}
+
+// Economy SVD: only the first r = k (or min(m, n) if k <= 0) singular triplets
+// are built, S is kept as a vector and U is never completed to m x m. gram
+// picks the eigenproblem (see svd.h), GRAM_AUTO the smaller one.
+thin_svd *svd_thin_gram(int m, int n, double **A, int k, double grey, int gram,
+                        int *iters) {
+    if (!A || m <= 0 || n <= 0) return NULL;
+    if (gram == GRAM_AUTO) gram = (m < n) ? GRAM_AAT : GRAM_ATA;
+    if (gram == GRAM_AAT) {
+        // factor A^T (n x m) through its Gram matrix, which is A A^T, and
+        // swap the roles of U and V
+        double **at = transpose(m, n, A);
+        thin_svd *t = svd_thin_gram(n, m, at, k, grey, GRAM_ATA, iters);
+        free_matrix(n, at);
+        if (!t) return NULL;
+        double **U = t->V;
+        t->V = t->U;
+        t->U = U;
+        t->m = m;
+        t->n = n;
+        return t;
+    }
+    int r = (m < n) ? m : n;
+    if (k > 0 && k < r) r = k;
+
+    double **at_a = gram_ata(m, n, A);
+
+    double *ev = (double *)malloc(n * sizeof(double));
+    double **evec = (double **)malloc(n * sizeof(double *));
+    for (int i = 0; i < n; i++) {
+        evec[i] = (double *)malloc(n * sizeof(double));
+    }
+    int rotations = jacobi_tol(at_a, ev, evec, n, grey_slack(m, n, A, grey), k);
+    if (iters) *iters = rotations;
+    free_matrix(n, at_a);
+
+    thin_svd *ret = thin_from_eigen(m, n, A, r, n, ev, evec);
+    free_matrix(n, evec);
+    free(ev);
+    return ret;
+}
+
+thin_svd *svd_thin(int m, int n, double **A, int k, double grey, int *iters) {
+    return svd_thin_gram(m, n, A, k, grey, GRAM_AUTO, iters);
+}
+
+/*
+ * Economy SVD warm started from the factorization of a previous, similar
+ * matrix (e.g. the previous frame of a video). Starting from prev->V we run
+ * block subspace iteration on A^T A with Rayleigh-Ritz, which for nearly
+ * identical frames converges in one or two steps of O(m n r) each, instead of
+ * the O(n^3) Jacobi solve.
+ *
+ * We fall back to a cold svd_thin() when there is no usable prev, when the
+ * energy captured by prev->V differs from prev's by more than SCENE_CUT (the
+ * scene changed), or when the iteration has not converged after WARM_ITERS
+ * steps. The result carries WARM_EXTRA more triplets than k so that it can seed
+ * the next frame. *warm is set to whether the warm start was used, and *iters
+ * to the number of subspace steps (warm) or Jacobi rotations (cold).
+ */
+#define SCENE_CUT 0.25
+#define WARM_ITERS 16
+#define WARM_EXTRA 8
+
+thin_svd *svd_warm(int m, int n, double **A, int k, double grey,
+                   const thin_svd *prev, int *warm, int *iters) {
+    if (!A || m <= 0 || n <= 0) return NULL;
+    int r = (m < n) ? m : n;
+    int b = (k > 0 && k + WARM_EXTRA < r) ? k + WARM_EXTRA : r;
+    if (k <= 0 || k > b) k = b;
+    *warm = 0;
+    if (!prev || prev->n != n || prev->r < b)
+        return svd_thin(m, n, A, b, grey, iters);
+
+    double slack = grey_slack(m, n, A, grey);
+    double prev_energy = 0.0;
+    for (int t = 0; t < b; t++) prev_energy += prev->S[t] * prev->S[t];
+
+    double **Q = (double **)malloc(n * sizeof(double *));
+    for (int i = 0; i < n; i++) {
+        Q[i] = (double *)malloc(b * sizeof(double));
+        for (int t = 0; t < b; t++) Q[i][t] = prev->V[i][t];
+    }
+    double **V = NULL, **Z = NULL;
+    double *theta = (double *)malloc(b * sizeof(double));
+    double **W = (double **)malloc(b * sizeof(double *));
+    for (int t = 0; t < b; t++) W[t] = (double *)malloc(b * sizeof(double));
+
+    int it, converged = 0;
+    for (it = 1; it <= WARM_ITERS; it++) {
+        // Rayleigh-Ritz: H = (A Q)^T (A Q), V = Q W
+        double **B = multiply(m, n, A, n, b, Q);
+        double **Bt = transpose(m, b, B);
+        double **H = multiply(b, m, Bt, m, b, B);
+        free_matrix(b, Bt);
+        jacobi(H, theta, W, b);
+        free_matrix(b, H);
+        if (it == 1) {
+            double energy = 0.0;
+            for (int t = 0; t < b; t++) energy += theta[t];
+            if (fabs(energy - prev_energy) > SCENE_CUT * prev_energy) {
+                free_matrix(m, B);
+                break;
+            }
+        }
+        free_matrix(n, V);
+        V = multiply(n, b, Q, b, b, W);
+        // Z = A^T A V, reusing A Q
+        double **BW = multiply(m, b, B, b, b, W);
+        free_matrix(m, B);
+        double **BWt = transpose(m, b, BW);
+        free_matrix(m, BW);
+        double **Zt = multiply(b, m, BWt, m, n, A);
+        free_matrix(b, BWt);
+        free_matrix(n, Z);
+        Z = transpose(b, n, Zt);
+        free_matrix(b, Zt);
+
+        // sorted Ritz values, to find each one's gap
+        double *sorted = (double *)malloc(b * sizeof(double));
+        for (int t = 0; t < b; t++) {
+            int j = t - 1;
+            while (j >= 0 && sorted[j] < theta[t]) {
+                sorted[j + 1] = sorted[j];
+                j--;
+            }
+            sorted[j + 1] = theta[t];
+        }
+        // converged when the residual is tiny, or (with a grey target) when the
+        // kept subspace is within res / (theta_t - cut) of the true one, cut
+        // being the largest discarded Ritz value
+        double cut = (k < b) ? sorted[k] : 0.0;
+        converged = 1;
+        for (int t = 0; t < b && converged; t++) {
+            if (theta[t] <= cut && k < b) continue; // discarded
+            double res = 0.0;
+            for (int i = 0; i < n; i++) {
+                double d = Z[i][t] - theta[t] * V[i][t];
+                res += d * d;
+            }
+            res = sqrt(res);
+            if (res > 1e-8 * sorted[0] && res > slack * (theta[t] - cut))
+                converged = 0;
+        }
+        free(sorted);
+        if (converged) break;
+
+        // next block: orthonormalize Z (modified Gram-Schmidt)
+        for (int t = 0; t < b; t++) {
+            for (int j = 0; j < t; j++) {
+                double dot = 0.0;
+                for (int i = 0; i < n; i++) dot += Z[i][j] * Z[i][t];
+                for (int i = 0; i < n; i++) Z[i][t] -= dot * Z[i][j];
+            }
+            double norm = 0.0;
+            for (int i = 0; i < n; i++) norm += Z[i][t] * Z[i][t];
+            norm = sqrt(norm);
+            for (int i = 0; i < n; i++) {
+                Z[i][t] = norm > 0.0 ? Z[i][t] / norm : 0.0;
+                Q[i][t] = Z[i][t];
+            }
+        }
+    }
+    free_matrix(n, Q);
+    free_matrix(n, Z);
+    free_matrix(b, W);
+
+    thin_svd *ret;
+    if (converged) {
+        *warm = 1;
+        if (iters) *iters = it;
+        ret = thin_from_eigen(m, n, A, b, b, theta, V);
+    } else {
+        ret = svd_thin(m, n, A, b, grey, iters);
+    }
+    free_matrix(n, V);
+    free(theta);
+    return ret;
+}
+
+void free_thin_svd(thin_svd *s) {
+    if (!s) return;
+    free_matrix(s->m, s->U);
+    free_matrix(s->n, s->V);
+    free(s->S);
+    free(s);
+}
+
 // // DEBUG
 // int main(void) {
 //     double **A = (double **)malloc(3 * sizeof(double *));
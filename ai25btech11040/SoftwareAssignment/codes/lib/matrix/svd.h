@@ -1,6 +1,32 @@
 #ifndef SVD_H
 #define SVD_H
 
+// Economy SVD: A ~ U diag(S) V^T with r singular triplets, S descending
+typedef struct {
+  int m, n, r;
+  double **U; // m x r
+  double *S;  // r
+  double **V; // n x r
+} thin_svd;
+
+// Which Gram matrix the eigensolver works on
+#define GRAM_AUTO 0 // the smaller of the two
+#define GRAM_ATA 1  // A^T A, n x n
+#define GRAM_AAT 2  // A A^T, m x m
+
+thin_svd *svd_thin(int m, int n, double **A, int k, double grey, int *iters);
+
+thin_svd *svd_thin_gram(int m, int n, double **A, int k, double grey, int gram,
+                        int *iters);
+
+thin_svd *svd_warm(int m, int n, double **A, int k, double grey,
+                   const thin_svd *prev, int *warm, int *iters);
+
+void free_thin_svd(thin_svd *s);
+
+// Full SVD, returns {U (m x m), S (m x n), V (n x n)}
 double ***svd(int m, int n, double **A);
 
+double ***svd_tol(int m, int n, double **A, double grey, int k, int *iters);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,330 @@
+// Orthonormalizing a tall m x r panel by tall-skinny QR. The rows are cut
+// into blocks which are factored independently (one thread each) by blocked
+// Householder QR in compact WY form, Q = I - Y T Y^T. Their r x r R factors
+// are stacked in pairs and factored again, up a binary tree, until a single
+// R is left. Q is then built top down: each node turns the r x r coefficients
+// it receives from its parent into coefficients for its two children, and
+// each leaf into its block of rows of Q.
+
+#include "tsqr.h"
+#include "helper.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define QR_NB 32       // columns per block reflector inside a factorization
+#define TSQR_ROWS 1024 // rows per leaf (at least 2r)
+
+static double **zeros(int m, int n) {
+  double **A = (double **)malloc(m * sizeof(double *));
+  for (int i = 0; i < m; i++)
+    A[i] = (double *)calloc(n, sizeof(double));
+  return A;
+}
+
+/*
+ * Householder QR of the b x r panel a (b >= r) in place: R on and above the
+ * diagonal, the Householder vectors below it (their leading 1 implied), and
+ * T (r x r, upper triangular) such that Q = H_0 H_1 ... H_{r-1} = I - Y T Y^T.
+ * Columns are reduced QR_NB at a time; each group is applied to the columns
+ * right of it as a single block reflector.
+ */
+static void house_qr(int b, int r, double **a, double **T) {
+  double *w = (double *)malloc(r * sizeof(double));
+  double **W = zeros(QR_NB, r);
+  for (int j0 = 0; j0 < r; j0 += QR_NB) {
+    int j1 = (j0 + QR_NB < r) ? j0 + QR_NB : r;
+    for (int j = j0; j < j1; j++) {
+      // reflector taking a[j:b][j] to (beta, 0, ..., 0)
+      double alpha = a[j][j], s = 0.0;
+      for (int i = j + 1; i < b; i++)
+        s += a[i][j] * a[i][j];
+      double tau = 0.0, beta = alpha;
+      if (s > 0.0) {
+        beta = -copysign(sqrt(alpha * alpha + s), alpha);
+        tau = (beta - alpha) / beta;
+        double sc = 1.0 / (alpha - beta);
+        for (int i = j + 1; i < b; i++)
+          a[i][j] *= sc;
+      }
+      a[j][j] = beta;
+
+      // apply it to the rest of this group of columns
+      for (int c = j + 1; c < j1; c++)
+        w[c] = a[j][c];
+      for (int i = j + 1; i < b; i++)
+        for (int c = j + 1; c < j1; c++)
+          w[c] += a[i][j] * a[i][c];
+      for (int c = j + 1; c < j1; c++)
+        a[j][c] -= tau * w[c];
+      for (int i = j + 1; i < b; i++) {
+        double v = tau * a[i][j];
+        for (int c = j + 1; c < j1; c++)
+          a[i][c] -= v * w[c];
+      }
+
+      // T[0:j][j] = -tau T[0:j][0:j] Y[:, 0:j]^T v
+      for (int l = 0; l < j; l++)
+        w[l] = a[j][l];
+      for (int i = j + 1; i < b; i++)
+        for (int l = 0; l < j; l++)
+          w[l] += a[i][l] * a[i][j];
+      for (int l = 0; l < j; l++) {
+        double t = 0.0;
+        for (int l2 = l; l2 < j; l2++)
+          t += T[l][l2] * w[l2];
+        T[l][j] = -tau * t;
+      }
+      for (int l = j + 1; l < r; l++)
+        T[l][j] = 0.0;
+      T[j][j] = tau;
+    }
+    if (j1 == r)
+      break;
+
+    // columns j1.. get H_{j1-1} ... H_{j0} = I - Yb Tb^T Yb^T, with Yb and Tb
+    // the part of Y and T belonging to this group
+    int nb = j1 - j0;
+    for (int l = 0; l < nb; l++)
+      for (int c = j1; c < r; c++)
+        W[l][c] = a[j0 + l][c]; // the implied 1 of column j0 + l
+    for (int i = j0 + 1; i < b; i++) {
+      int top = (i < j1) ? i - j0 : nb; // Y[i][j0 + l] is stored for l < top
+      for (int l = 0; l < top; l++) {
+        double y = a[i][j0 + l];
+        for (int c = j1; c < r; c++)
+          W[l][c] += y * a[i][c];
+      }
+    }
+    for (int l = nb - 1; l >= 0; l--) // W = Tb^T W, bottom up in place
+      for (int c = j1; c < r; c++) {
+        double t = 0.0;
+        for (int l2 = 0; l2 <= l; l2++)
+          t += T[j0 + l2][j0 + l] * W[l2][c];
+        W[l][c] = t;
+      }
+    for (int i = j0; i < b; i++) {
+      int top = (i < j1) ? i - j0 : nb;
+      for (int l = 0; l <= top && l < nb; l++) {
+        double y = (l == top) ? 1.0 : a[i][j0 + l];
+        for (int c = j1; c < r; c++)
+          a[i][c] -= y * W[l][c];
+      }
+    }
+  }
+  free(w);
+  free_matrix(QR_NB, W);
+}
+
+/*
+ * Overwrites the factored b x r panel a (Y below the diagonal) with its rows
+ * of Q C = (I - Y T Y^T) [C; 0], C being r x r.
+ */
+static void apply_q(int b, int r, double **a, double **T, double **C) {
+  // W = T Y1^T C, Y1 being the unit lower triangular top r x r of Y
+  double **W = zeros(r, r);
+  for (int i = 0; i < r; i++)
+    for (int l = 0; l <= i; l++) {
+      double y = (l == i) ? 1.0 : a[i][l];
+      for (int c = 0; c < r; c++)
+        W[l][c] += y * C[i][c];
+    }
+  for (int l = 0; l < r; l++) // upper triangular T, top down in place
+    for (int c = 0; c < r; c++) {
+      double t = 0.0;
+      for (int l2 = l; l2 < r; l2++)
+        t += T[l][l2] * W[l2][c];
+      W[l][c] = t;
+    }
+  double *row = (double *)malloc(r * sizeof(double));
+  for (int i = 0; i < b; i++) {
+    for (int c = 0; c < r; c++)
+      row[c] = (i < r) ? C[i][c] : 0.0;
+    int top = (i < r) ? i : r;
+    for (int l = 0; l <= top && l < r; l++) {
+      double y = (l == i) ? 1.0 : a[i][l];
+      for (int c = 0; c < r; c++)
+        row[c] -= y * W[l][c];
+    }
+    memcpy(a[i], row, r * sizeof(double));
+  }
+  free(row);
+  free_matrix(r, W);
+}
+
+struct leaf {
+  int b, r;
+  double **a; // rows of U
+  double **T;
+  double **C; // coefficients from the tree
+};
+
+struct leaf_job {
+  struct leaf *leaves;
+  int count, stride, first, apply;
+};
+
+static void *leaf_worker(void *arg) {
+  struct leaf_job *job = arg;
+  for (int i = job->first; i < job->count; i += job->stride) {
+    struct leaf *l = &job->leaves[i];
+    if (job->apply)
+      apply_q(l->b, l->r, l->a, l->T, l->C);
+    else
+      house_qr(l->b, l->r, l->a, l->T);
+  }
+  return NULL;
+}
+
+// Factor (apply = 0) or build Q for (apply = 1) every leaf, spread over the
+// cores
+static void run_leaves(struct leaf *leaves, int count, int apply) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int nt = (cores > 1) ? (int)cores : 1;
+  if (nt > count)
+    nt = count;
+  pthread_t *th = (pthread_t *)malloc(nt * sizeof(pthread_t));
+  struct leaf_job *jobs = (struct leaf_job *)malloc(nt * sizeof(struct leaf_job));
+  for (int t = 0; t < nt; t++) {
+    jobs[t] = (struct leaf_job){leaves, count, nt, t, apply};
+    if (t > 0)
+      pthread_create(&th[t], NULL, leaf_worker, &jobs[t]);
+  }
+  leaf_worker(&jobs[0]);
+  for (int t = 1; t < nt; t++)
+    pthread_join(th[t], NULL);
+  free(th);
+  free(jobs);
+}
+
+// A node of the reduction tree: the factored stack of its children's R's,
+// or just the one child passed up when it has no sibling
+struct node {
+  double **a; // 2r x r
+  double **T;
+  int single;
+};
+
+int tsqr(int m, int r, double **U, double **R) {
+  if (m < r)
+    return -1;
+  if (r == 0)
+    return 0;
+  int rows = (2 * r > TSQR_ROWS) ? 2 * r : TSQR_ROWS;
+  int count = m / rows;
+  if (count < 1)
+    count = 1;
+  struct leaf *leaves = (struct leaf *)malloc(count * sizeof(struct leaf));
+  for (int i = 0; i < count; i++) {
+    int lo = (int)((long)i * m / count), hi = (int)((long)(i + 1) * m / count);
+    leaves[i] = (struct leaf){hi - lo, r, U + lo, zeros(r, r), NULL};
+  }
+  run_leaves(leaves, count, 0);
+
+  // reduction tree, level 0 being the leaves' R's
+  int levels = 0;
+  for (int c = count; c > 1; c = (c + 1) / 2)
+    levels++;
+  struct node **tree = (struct node **)malloc((levels + 1) * sizeof(struct node *));
+  int *width = (int *)malloc((levels + 1) * sizeof(int));
+  double ***Rs = (double ***)malloc(count * sizeof(double **));
+  for (int i = 0; i < count; i++)
+    Rs[i] = leaves[i].a;
+  width[0] = count;
+  for (int L = 1; L <= levels; L++) {
+    width[L] = (width[L - 1] + 1) / 2;
+    tree[L] = (struct node *)malloc(width[L] * sizeof(struct node));
+    for (int j = 0; j < width[L]; j++) {
+      struct node *nd = &tree[L][j];
+      nd->single = (2 * j + 1 >= width[L - 1]);
+      if (nd->single) {
+        nd->a = NULL;
+        nd->T = NULL;
+        Rs[j] = Rs[2 * j];
+        continue;
+      }
+      nd->a = zeros(2 * r, r);
+      nd->T = zeros(r, r);
+      for (int i = 0; i < r; i++)
+        for (int c = i; c < r; c++) {
+          nd->a[i][c] = Rs[2 * j][i][c];
+          nd->a[r + i][c] = Rs[2 * j + 1][i][c];
+        }
+      house_qr(2 * r, r, nd->a, nd->T);
+      Rs[j] = nd->a;
+    }
+  }
+
+  // flip signs so that R has a non-negative diagonal: Q D, D R with D = +-1
+  double **C = zeros(r, r);
+  for (int i = 0; i < r; i++)
+    C[i][i] = (Rs[0][i][i] < 0.0) ? -1.0 : 1.0;
+  if (R)
+    for (int i = 0; i < r; i++)
+      for (int c = 0; c < r; c++)
+        R[i][c] = (c >= i) ? C[i][i] * Rs[0][i][c] : 0.0;
+
+  // coefficients down the tree, ending up in the leaves' C
+  double ***coef = (double ***)malloc(count * sizeof(double **));
+  coef[0] = C;
+  for (int L = levels; L >= 1; L--) {
+    for (int j = width[L] - 1; j >= 0; j--) {
+      struct node *nd = &tree[L][j];
+      double **Cj = coef[j];
+      if (nd->single) {
+        coef[2 * j] = Cj;
+        continue;
+      }
+      apply_q(2 * r, r, nd->a, nd->T, Cj);
+      free_matrix(r, Cj);
+      coef[2 * j] = zeros(r, r);
+      coef[2 * j + 1] = zeros(r, r);
+      for (int i = 0; i < r; i++) {
+        memcpy(coef[2 * j][i], nd->a[i], r * sizeof(double));
+        memcpy(coef[2 * j + 1][i], nd->a[r + i], r * sizeof(double));
+      }
+    }
+  }
+  for (int i = 0; i < count; i++)
+    leaves[i].C = coef[i];
+  run_leaves(leaves, count, 1);
+
+  for (int i = 0; i < count; i++) {
+    free_matrix(r, leaves[i].T);
+    free_matrix(r, leaves[i].C);
+  }
+  for (int L = 1; L <= levels; L++) {
+    for (int j = 0; j < width[L]; j++)
+      if (!tree[L][j].single) {
+        free_matrix(2 * r, tree[L][j].a);
+        free_matrix(r, tree[L][j].T);
+      }
+    free(tree[L]);
+  }
+  free(tree);
+  free(width);
+  free(Rs);
+  free(coef);
+  free(leaves);
+  return 0;
+}
+
+double orthogonality(int m, int r, double **U) {
+  double **G = zeros(r, r);
+  for (int i = 0; i < m; i++)
+    for (int a = 0; a < r; a++) {
+      double u = U[i][a];
+      for (int b = a; b < r; b++)
+        G[a][b] += u * U[i][b];
+    }
+  double s = 0.0;
+  for (int a = 0; a < r; a++)
+    for (int b = a; b < r; b++) {
+      double d = G[a][b] - (a == b);
+      s += (a == b) ? d * d : 2.0 * d * d;
+    }
+  free_matrix(r, G);
+  return sqrt(s);
+}
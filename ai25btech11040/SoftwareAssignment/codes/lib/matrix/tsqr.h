@@ -0,0 +1,13 @@
+#ifndef TSQR_H
+#define TSQR_H
+
+// Tall-skinny QR: replaces the m x r panel U (m >= r, only its first r
+// columns are used) by Q with orthonormal columns and U = Q R, R upper
+// triangular with a non-negative diagonal, written to R (r x r) unless it is
+// NULL. Returns 0, or -1 if m < r.
+int tsqr(int m, int r, double **U, double **R);
+
+// ||U^T U - I||_F for the first r columns of an m x r matrix
+double orthogonality(int m, int r, double **U);
+
+#endif // TSQR_H
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <zlib.h>
 
+#include "readpng.h"
+
 /* Table of CRCs of all 8-bit messages. */
 unsigned long crc_table[256];
 
@@ -63,11 +65,67 @@ int paeth(int a, int b, int c) {
     return c;
 }
 
-int **readpng(const char *filename, int ihdr_[7]) {
+// Undo the PNG filter of one scanline in place. cur holds the filter byte
+// followed by w bytes, prev is the previous unfiltered scanline (all zeros for
+// the first one), bpp the number of bytes per pixel.
+static int unfilter(unsigned char *cur, const unsigned char *prev, int w,
+                    int bpp) {
+  int ftype = cur[0]; // filter type
+  unsigned char *line = cur + 1;
+  for (int j = 0; j < w; j++) {
+    int left = j - bpp < 0 ? 0 : line[j - bpp];
+    int up = prev[j];
+    int up_left = j - bpp < 0 ? 0 : prev[j - bpp];
+    switch (ftype) {
+    case 0:
+      break;
+    case 1:
+      // Sub filter
+      line[j] = (line[j] + left) % 256;
+      break;
+    case 2:
+      // Up filter
+      line[j] = (line[j] + up) % 256;
+      break;
+    case 3:
+      // Average filter
+      line[j] = (line[j] + (left + up) / 2) % 256;
+      break;
+    case 4:
+      // Paeth filter
+      line[j] = (line[j] + paeth(left, up, up_left)) % 256;
+      break;
+    default:
+      return -1; // Invalid filter type
+    }
+  }
+  return 0;
+}
+
+// Convert an unfiltered scanline to pixel values. Samples narrower than a
+// byte are packed from the most significant bit, 16-bit ones are big-endian.
+static void unpack(const unsigned char *line, int width, int bd, int *row) {
+  for (int j = 0; j < width; j++) {
+    if (bd < 8) {
+      int bit = j * bd;
+      row[j] = (line[bit / 8] >> (8 - bd - bit % 8)) & ((1 << bd) - 1);
+    } else {
+      row[j] = 0;
+      for (int z = 0; z < bd / 8; z++) {
+        row[j] = (row[j] << 8) | line[j * (bd / 8) + z];
+      }
+    }
+  }
+}
+
+// verbose: print the header, text chunks and errors (readpng_rows() does)
+int readpng_stream(const char *filename, int ihdr_[7], png_row_fn row_fn,
+                   void *ctx, int verbose) {
   FILE *file = fopen(filename, "rb");
   if (file == NULL) {
-    printf("Error opening file");
-    return NULL;
+    if (verbose)
+      printf("Error opening file");
+    return -1;
   }
   long filelen;
   fseek(file, 0, SEEK_END);
@@ -79,13 +137,16 @@ int **readpng(const char *filename, int ihdr_[7]) {
   unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
   int ihdr[7] = {}; // Represents width, height, bit depth, color type,
                     // compression method, filter method, interlace method
-  int x = 0, y = 0;
 
   unsigned long long i = 0;
-  int **array = NULL;
-  Bytef *decompressed = NULL;
-  int **unfiltered = NULL;
-  
+  int status = -1;
+  unsigned char *chunkData = NULL;
+  // Only two scanlines are ever kept: the one being inflated (with its filter
+  // byte) and the previous one after unfiltering, plus one row of pixels
+  unsigned char *cur = NULL, *prev = NULL;
+  int *row = NULL;
+  int w = 0, bpp = 0, y = 0, filled = 0, done = 0;
+
   z_stream strm;
   strm.zalloc = Z_NULL;
   strm.zfree = Z_NULL;
@@ -93,8 +154,12 @@ int **readpng(const char *filename, int ihdr_[7]) {
   strm.avail_in = 0;
   strm.next_in = Z_NULL;
   int ret = inflateInit(&strm);
-  if (ret != Z_OK)
-    goto malformed;
+  if (ret != Z_OK) {
+    fclose(file);
+    if (verbose)
+      printf("Malformed input");
+    return -1;
+  }
 
   while (i < filelen && !feof(file)) {
     // Make sure its a PNG image
@@ -122,8 +187,9 @@ int **readpng(const char *filename, int ihdr_[7]) {
     // string
     unsigned char chunkType[5] = {0};
     fread(chunkType, 1, 4, file);
-    unsigned char *chunkData = malloc(chunkLength);
-    fread(chunkData, 1, chunkLength, file);
+    chunkData = malloc(chunkLength ? chunkLength : 1);
+    if (fread(chunkData, 1, chunkLength, file) != chunkLength)
+      goto malformed;
     unsigned char crc[4];
     fread(crc, 1, 4, file);
     // printf("%s %u\n", chunkType, chunkLength); // DEBUG
@@ -153,45 +219,64 @@ int **readpng(const char *filename, int ihdr_[7]) {
       ihdr_[0] = ihdr[0];
       ihdr_[1] = ihdr[1];
 
-      printf(
-          "Width: %d, Height: %d, Bit depth: %d, Color type: %d, Compression "
-          "method: %d, Filter method: %d, Interlace method: %d\n",
-          ihdr[0], ihdr[1], ihdr[2], ihdr[3], ihdr[4], ihdr[5],
-          ihdr[6]); // DEBUG
+      if (verbose)
+        printf(
+            "Width: %d, Height: %d, Bit depth: %d, Color type: %d, Compression "
+            "method: %d, Filter method: %d, Interlace method: %d\n",
+            ihdr[0], ihdr[1], ihdr[2], ihdr[3], ihdr[4], ihdr[5],
+            ihdr[6]); // DEBUG
       if (ihdr[3] != 0 || ihdr[6] != 0)
         goto notimplemented; // TODO: Implement for all types of PNGs
 
-      if (ihdr[4] != 0 || ihdr[5] != 0)
+      if (ihdr[4] != 0 || ihdr[5] != 0 || ihdr[0] <= 0 || ihdr[1] <= 0)
         goto malformed;
+      if (ihdr[2] != 1 && ihdr[2] != 2 && ihdr[2] != 4 && ihdr[2] != 8 &&
+          ihdr[2] != 16)
+        goto malformed;
+
+      bpp = (ihdr[2] + 7) / 8; // bytes per pixel, for grayscale images
+      w = (ihdr[0] * ihdr[2] + 7) / 8;
+      free(cur);
+      free(prev);
+      free(row);
+      cur = malloc(w + 1);
+      prev = calloc(w, 1);
+      row = malloc(ihdr[0] * sizeof(int));
     } else if (strcmp((const char *)chunkType, "IEND") == 0) {
       // Image end chunk
-      // TODO
+      free(chunkData);
+      chunkData = NULL;
       break;
     } else if (strcmp((const char *)chunkType, "IDAT") == 0) {
-      // Image data chunk
-      if (chunkLength == 0)
+      // Image data chunk, inflated a scanline at a time: each complete
+      // scanline is unfiltered against the previous one and handed to row_fn
+      // before the rest of the stream is read
+      if (chunkLength == 0 || cur == NULL)
         goto malformed;
-      if (decompressed == NULL) {
-        decompressed = malloc(ihdr[1] * (ihdr[0] + 1) * ihdr[2] / 8);
-      } // TODO: Implement ZLIB decompression
-      strm.next_out = decompressed;
-      strm.avail_out = ihdr[1] * (ihdr[0] + 1) * ihdr[2] / 8;
       strm.next_in = chunkData;
       strm.avail_in = chunkLength;
-      ret = inflate(&strm, Z_NO_FLUSH);
-      switch (ret) {
-      case Z_NEED_DICT:
-      case Z_DATA_ERROR:
-      case Z_MEM_ERROR: {
-        inflateEnd(&strm);
-        goto malformed; // Error during decompression
-        break;
-      }
-      case Z_STREAM_END:
-        inflateEnd(&strm);
+      while (!done) {
+        strm.next_out = cur + filled;
+        strm.avail_out = w + 1 - filled;
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR)
+          goto malformed; // Error during decompression
+        int full = strm.avail_out == 0;
+        filled = w + 1 - strm.avail_out;
+        if (full) {
+          if (unfilter(cur, prev, w, bpp) != 0)
+            goto malformed;
+          unpack(cur + 1, ihdr[0], ihdr[2], row);
+          row_fn(y, row, ctx);
+          memcpy(prev, cur + 1, w);
+          filled = 0;
+          y++;
+        }
+        if (ret == Z_STREAM_END || y == ihdr[1])
+          done = 1;
+        else if (!full)
+          break; // this chunk is used up, wait for the next IDAT
       }
-
-      // TODO Read IDAT for all other types of PNGs
     } else if (strcmp((const char *)chunkType, "pHYs") == 0) {
       // Physical pixel dimensions chunk
       if (chunkLength != 9)
@@ -211,13 +296,14 @@ int **readpng(const char *filename, int ihdr_[7]) {
 
       unitSpecifier = chunkData[8];
 
-      printf("Pixels per unit: %u x %u, Unit: %s\n", x_pixels_per_unit,
-             y_pixels_per_unit,
-             unitSpecifier == 1 ? "meter" : "unknown"); // DEBUG
-    } else if (strcmp((const char *)chunkType, "tEXt") == 0) {
+      if (verbose)
+        printf("Pixels per unit: %u x %u, Unit: %s\n", x_pixels_per_unit,
+               y_pixels_per_unit,
+               unitSpecifier == 1 ? "meter" : "unknown"); // DEBUG
+    } else if (strcmp((const char *)chunkType, "tEXt") == 0 && verbose) {
       // Textual data chunk
       int i = 0;
-      while (chunkData[i] != 0 && i < chunkLength) {
+      while (i < chunkLength && chunkData[i] != 0) {
         printf("%c", chunkData[i]);
         i++;
       }
@@ -236,113 +322,64 @@ int **readpng(const char *filename, int ihdr_[7]) {
 
     i += 4 + 4 + chunkLength + 4;
     free(chunkData);
+    chunkData = NULL;
   }
 
-  int bd = ihdr[2]; // bit depth
-  int bpp = (bd + 7) / 8; // bytes per pixel, for grayscale images
-  int w = (ihdr[0] * bd + 7) / 8;
-  // Unfiltering process
-  unfiltered = malloc(ihdr[1] * sizeof(int *));
-  for (int j = 0; j < ihdr[1]; j++) {
-    unfiltered[j] = calloc(w, sizeof(int));
-  }
-
-  for (int i = 0; i < ihdr[1]; i++) {
-    int ftype = decompressed[i * (w + 1)]; // filter type
-    // printf("Scanline %d filter type: %d\n", i, ftype); // DEBUG
-    for (int j = 1; j <= w; j++) {
-      int k = decompressed[i * (w + 1) + j];
-      switch (ftype) {
-      case 0:
-        unfiltered[i][j - 1] = k;
-        break;
-      case 1:
-        // Sub filter
-        unfiltered[i][j - 1] = (k + (j - 1 - bpp < 0 ? 0 : unfiltered[i][j - 1 - bpp])) % 256;
-        break;
-      case 2:
-        // Up filter
-        unfiltered[i][j - 1] = (k + (i == 0 ? 0 : unfiltered[i - 1][j - 1])) % 256;
-        break;
-      case 3:
-        // Average filter
-        {
-          int left = 0, up = 0;
-          if (j - 1 - bpp >= 0)
-            left = unfiltered[i][j - 1 - bpp];
-          if (i > 0)
-            up = unfiltered[i - 1][j - 1];
-          unfiltered[i][j - 1] = (k + ((left + up) / 2)) % 256;
-          break;
-        }
-      case 4:
-        // Paeth filter
-        {
-          int left = 0, up = 0, up_left = 0;
-          if (j - 1 - bpp >= 0)
-            left = unfiltered[i][j - 1 - bpp];
-          if (i > 0)
-            up = unfiltered[i - 1][j - 1];
-          if (i > 0 && j - 1 - bpp >= 0)
-            up_left = unfiltered[i - 1][j - 1 - bpp];
-          unfiltered[i][j - 1] = (k + paeth(left, up, up_left)) % 256;
-          break;
-        }
-      default:
-        goto malformed; // Invalid filter type
-      }
-    }
-  }
-
-  // DEBUG: Print unfiltered data
-  // printf("Unfiltered data:\n");
-  // for (int i = 0; i < ihdr[1]; i++) {
-  //   for (int j = 0; j < (ihdr[0] * bd + 7) / 8; j++) {
-  //     printf("%4d", unfiltered[i][j]);
-  //     // printf("\x1B[48;5;%dm  \x1B[0m", 232 + (unfiltered[i][j])*23/255);
-  //   }
-  //   printf("\n");
-  // }
-
-  array = malloc(ihdr[1] * sizeof(int *));
-  for (int j = 0; j < ihdr[1]; j++) {
-    array[j] = calloc(ihdr[0], sizeof(int));
-  }
-
-  // Convert unfiltered data to final pixel values
-  for (int i = 0; i < ihdr[1]; i++) {
-    for (int j = 0; j < ihdr[0]; j++) {
-      for (int z = 0; z < bd / 8; z++) {
-        array[i][j] = (array[i][j] << 8) | unfiltered[i][j * (bd / 8) + z];
-      }
-    }
-  }
-  // printf("Array data:\n");
-  // for (int i = 0; i < ihdr[1]; i++) {
-  //   for (int j = 0; j < ihdr[0]; j++) {
-  //     printf("\x1B[48;5;%dm  \x1B[0m",
-  //            232 + (array[i][j]) * 23 / ((1 << bd) - 1));
-  //   }
-  //   printf("\n");
-  // }
+  if (cur == NULL || y < ihdr[1])
+    goto malformed; // no header, or the image data stops early
+  status = 0;
 
   /* Section for various error labels */
   if (0) {
-    free(array);
-    fclose(file);
-    if (0) {
-    malformed:
+  malformed:
+    if (verbose)
       printf("Malformed input");
-    }
-    if (0) {
-    notimplemented:
+  }
+  if (0) {
+  notimplemented:
+    if (verbose)
       printf("Feature not implemented");
-    }
-    return NULL;
   }
 
+  inflateEnd(&strm);
+  free(chunkData);
+  free(cur);
+  free(prev);
+  free(row);
   fclose(file);
-  return array;
+  return status;
+}
+
+int readpng_rows(const char *filename, int ihdr_[7], png_row_fn row_fn,
+                 void *ctx) {
+  return readpng_stream(filename, ihdr_, row_fn, ctx, 1);
+}
+
+// readpng() keeps every row, as a height x width array of pixel values
+struct collect {
+  const int *ihdr;
+  int **array;
+};
+
+static void collect_row(int y, const int *row, void *ctx) {
+  struct collect *c = ctx;
+  if (c->array == NULL)
+    c->array = calloc(c->ihdr[1], sizeof(int *));
+  c->array[y] = malloc(c->ihdr[0] * sizeof(int));
+  memcpy(c->array[y], row, c->ihdr[0] * sizeof(int));
+}
+
+int **readpng(const char *filename, int ihdr_[7]) {
+  struct collect c = {ihdr_, NULL};
+  if (readpng_rows(filename, ihdr_, collect_row, &c) != 0) {
+    if (c.array) {
+      for (int j = 0; j < ihdr_[1]; j++)
+        free(c.array[j]);
+      free(c.array);
+    }
+    return NULL;
+  }
+  return c.array;
 }
 
 // /* DEBUG */
@@ -3,6 +3,16 @@
 
 int paeth(int a, int b, int c);
 
+// Called for every scanline as soon as it is decoded: y is the row index and
+// row holds the width pixel values of that row (only valid during the call)
+typedef void (*png_row_fn)(int y, const int *row, void *ctx);
+
+int readpng_stream(const char *filename, int ihdr_[7], png_row_fn row_fn,
+                   void *ctx, int verbose);
+
+int readpng_rows(const char *filename, int ihdr_[7], png_row_fn row_fn,
+                 void *ctx);
+
 int **readpng(const char *filename, int ihdr_[7]);
 
 #endif
\ No newline at end of file
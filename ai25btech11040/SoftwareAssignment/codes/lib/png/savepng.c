@@ -3,6 +3,8 @@
 #include <string.h>
 #include <zlib.h>
 
+#include "savepng.h"
+
 static int write_be32(FILE *f, int v) {
     unsigned char b[4];
     b[0] = (v >> 24) & 0xFF;
@@ -25,28 +27,145 @@ static int write_chunk(FILE *f, const char type[4], const unsigned char *data, i
     return 0;
 }
 
-void savepng(const char *filename, double **image, int ihdr[7]) {
-    if (!filename || !image || !ihdr) return;
+/* Output levels: grey value of each sample value, and the level nearest to
+   each rounded 8-bit grey */
+struct levels {
+    int count;
+    unsigned char value[256];
+    unsigned char nearest[256];
+};
+
+static void nearest_levels(struct levels *q) {
+    for (int v = 0; v < 256; ++v) {
+        int best = 0;
+        for (int l = 1; l < q->count; ++l)
+            if (abs(q->value[l] - v) < abs(q->value[best] - v)) best = l;
+        q->nearest[v] = (unsigned char)best;
+    }
+}
+
+/* Optimal palette of at most max_levels greys for a histogram of 8-bit
+   values. In one dimension the optimal clusters are runs of consecutive
+   values, so the least squared error over the distinct values x_1 < ... <
+   x_n is found exactly by dynamic programming over where the runs split:
+     best[c][j] = min_i best[c-1][i-1] + cost(i, j)
+   with cost(i, j) the squared error of x_i..x_j about their mean, read off
+   prefix sums of the counts, the values and their squares. This is
+   O(max_levels n^2) on at most 256 values, whatever the image size. */
+static int fit_palette(const double hist[256], int max_levels, struct levels *q) {
+    int x[256], n = 0;
+    for (int v = 0; v < 256; ++v)
+        if (hist[v] > 0) x[n++] = v;
+    if (n <= max_levels) {
+        /* every grey gets its own entry: lossless */
+        q->count = n;
+        for (int i = 0; i < n; ++i) q->value[i] = (unsigned char)x[i];
+        nearest_levels(q);
+        return 0;
+    }
+    double s0[257], s1[257], s2[257];
+    s0[0] = s1[0] = s2[0] = 0.0;
+    for (int i = 0; i < n; ++i) {
+        double h = hist[x[i]];
+        s0[i + 1] = s0[i] + h;
+        s1[i + 1] = s1[i] + h * x[i];
+        s2[i + 1] = s2[i] + h * x[i] * x[i];
+    }
+    /* cost of x_i..x_j (0-based, inclusive) */
+#define RUN_COST(i, j) (s2[(j) + 1] - s2[i] - \
+        (s1[(j) + 1] - s1[i]) * (s1[(j) + 1] - s1[i]) / (s0[(j) + 1] - s0[i]))
+    double *best = (double *)malloc(sizeof(double) * max_levels * n);
+    int *start = (int *)malloc(sizeof(int) * max_levels * n);
+    if (!best || !start) { free(best); free(start); return -1; }
+    for (int j = 0; j < n; ++j) {
+        best[j] = RUN_COST(0, j);
+        start[j] = 0;
+    }
+    for (int c = 1; c < max_levels; ++c) {
+        for (int j = 0; j < n; ++j) {
+            double b = best[(c - 1) * n + j];
+            int s = -1; /* no new run: fewer levels than allowed */
+            for (int i = 1; i <= j; ++i) {
+                double e = best[(c - 1) * n + i - 1] + RUN_COST(i, j);
+                if (e < b) { b = e; s = i; }
+            }
+            best[c * n + j] = b;
+            start[c * n + j] = s;
+        }
+    }
+#undef RUN_COST
+    /* walk back from the last value, one run per level */
+    int ends[256], count = 0;
+    for (int c = max_levels - 1, j = n - 1; j >= 0; --c) {
+        int s = start[c * n + j];
+        if (s < 0 && c > 0) continue; /* same split with one level fewer */
+        ends[count++] = j;
+        j = s - 1;
+    }
+    q->count = count;
+    for (int l = 0, i = 0; l < count; ++l) {
+        int j = ends[count - 1 - l];
+        q->value[l] = (unsigned char)((s1[j + 1] - s1[i]) / (s0[j + 1] - s0[i]) + 0.5);
+        i = j + 1;
+    }
+    free(best);
+    free(start);
+    nearest_levels(q);
+    return 0;
+}
+
+static unsigned char to_byte(double v) {
+    if (v < 0.0) v = 0.0;
+    if (v > 255.0) v = 255.0;
+    return (unsigned char)(v + 0.5);
+}
+
+int savepng_rows_dither(const char *filename, int ihdr[7], png_fill_fn fill,
+                        void *ctx, int dither) {
+    if (!filename || !fill || !ihdr) return -1;
 
     int width = ihdr[0];
     int height = ihdr[1];
     int bit_depth = ihdr[2];
     int color_type = ihdr[3];
 
-    /* Only support 8-bit grayscale */
-    if (width <= 0 || height <= 0) return;
-    if (bit_depth != 8 || color_type != 0) {
-        fprintf(stderr, "savepng: only 8-bit grayscale supported (bit_depth=%d color_type=%d)\n",
-                bit_depth, color_type);
-        return;
+    /* 1, 2, 4 or 8-bit grayscale or indexed */
+    if (width <= 0 || height <= 0) return -1;
+    if ((bit_depth != 1 && bit_depth != 2 && bit_depth != 4 && bit_depth != 8) ||
+        (color_type != 0 && color_type != 3)) {
+        fprintf(stderr, "savepng: only 1, 2, 4 or 8-bit grayscale or indexed supported "
+                "(bit_depth=%d color_type=%d)\n", bit_depth, color_type);
+        return -1;
+    }
+
+    double *vals = (double *)malloc((size_t)width * sizeof(double));
+    if (!vals) return -1;
+
+    /* Grayscale levels are fixed by the depth, spread evenly over 0..255;
+       a palette is fitted to a histogram of the image, collected in a first
+       pass over the rows */
+    struct levels q;
+    if (color_type == 0) {
+        q.count = 1 << bit_depth;
+        for (int l = 0; l < q.count; ++l)
+            q.value[l] = (unsigned char)(l * 255 / (q.count - 1));
+        for (int v = 0; v < 256; ++v)
+            q.nearest[v] = (unsigned char)((v * (q.count - 1) + 127) / 255);
+    } else {
+        double hist[256] = {0};
+        for (int y = 0; y < height; ++y) {
+            fill(y, vals, ctx);
+            for (int x = 0; x < width; ++x) hist[to_byte(vals[x])] += 1.0;
+        }
+        if (fit_palette(hist, 1 << bit_depth, &q) != 0) { free(vals); return -1; }
     }
 
     FILE *f = fopen(filename, "wb");
-    if (!f) { perror("savepng fopen"); return; }
+    if (!f) { perror("savepng fopen"); free(vals); return -1; }
 
     /* PNG signature */
     const unsigned char png_sig[8] = {137,80,78,71,13,10,26,10};
-    if (fwrite(png_sig, 1, 8, f) != 8) { fclose(f); return; }
+    if (fwrite(png_sig, 1, 8, f) != 8) { free(vals); fclose(f); return -1; }
 
     /* IHDR chunk (13 bytes) */
     unsigned char ihdr_buf[13];
@@ -66,50 +185,157 @@ void savepng(const char *filename, double **image, int ihdr[7]) {
 
     if (write_chunk(f, "IHDR", ihdr_buf, sizeof(ihdr_buf)) != 0) {
         fprintf(stderr, "savepng: failed writing IHDR\n");
+        free(vals);
         fclose(f);
-        return;
+        return -1;
     }
 
-    /* Build raw image data: each scanline = filter byte (0) + width bytes (grayscale) */
-    size_t row_bytes = (size_t)width;
-    size_t raw_len = (row_bytes + 1) * (size_t)height;
-    unsigned char *raw = (unsigned char *)malloc(raw_len);
-    if (!raw) { fclose(f); return; }
-
-    for (int y = 0; y < height; ++y) {
-        unsigned char *row = raw + (size_t)y * (row_bytes + 1);
-        row[0] = 0; /* no filter (0) */
-        for (int x = 0; x < width; ++x) {
-            double v = image[y][x];
-            if (v < 0.0) v = 0.0;
-            if (v > 255.0) v = 255.0;
-            row[1 + x] = (unsigned char)(v + 0.5);
+    /* PLTE: the fitted greys, r = g = b */
+    if (color_type == 3) {
+        unsigned char plte[3 * 256];
+        for (int l = 0; l < q.count; ++l)
+            plte[3 * l] = plte[3 * l + 1] = plte[3 * l + 2] = q.value[l];
+        if (write_chunk(f, "PLTE", plte, 3 * q.count) != 0) {
+            fprintf(stderr, "savepng: failed writing PLTE\n");
+            free(vals);
+            fclose(f);
+            return -1;
         }
     }
 
-    /* Compress raw with zlib (produces zlib stream expected by PNG IDAT) */
-    uLongf cmp_bound = compressBound((uLong)raw_len);
-    unsigned char *cmp = (unsigned char *)malloc(cmp_bound);
-    if (!cmp) { free(raw); fclose(f); return; }
-    int zret = compress2(cmp, &cmp_bound, raw, (uLong)raw_len, Z_BEST_COMPRESSION);
+    /* Scanlines are built one at a time (filter byte 0 + the samples packed
+       most significant bits first, 8 / bit_depth to a byte) and fed to
+       deflate as they are produced; only the compressed stream is kept so
+       it can go out as a single IDAT chunk. With dithering, err carries the
+       rounding error of the previous row and next collects it for the
+       following one (one pixel of padding on either side). */
+    size_t row_bytes = ((size_t)width * bit_depth + 7) / 8;
+    unsigned char *raw = (unsigned char *)malloc(row_bytes + 1);
+    double *err = dither ? (double *)calloc(width + 2, sizeof(double)) : NULL;
+    double *next = dither ? (double *)calloc(width + 2, sizeof(double)) : NULL;
+    size_t cmp_cap = 4096, cmp_len = 0;
+    unsigned char *cmp = (unsigned char *)malloc(cmp_cap);
+    if (!raw || !cmp || (dither && (!err || !next))) {
+        free(raw); free(vals); free(cmp); free(err); free(next); fclose(f);
+        return -1;
+    }
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    int zret = deflateInit(&strm, Z_BEST_COMPRESSION);
     if (zret != Z_OK) {
-        fprintf(stderr, "savepng: compress2 failed (%d)\n", zret);
-        free(cmp); free(raw); fclose(f);
-        return;
+        fprintf(stderr, "savepng: deflateInit failed (%d)\n", zret);
+        free(cmp); free(vals); free(raw); free(err); free(next); fclose(f);
+        return -1;
+    }
+
+    for (int y = 0; y < height; ++y) {
+        fill(y, vals, ctx);
+        memset(raw, 0, row_bytes + 1); /* filter byte 0: no filter */
+        for (int x = 0; x < width; ++x) {
+            int l;
+            if (dither) {
+                /* Floyd-Steinberg: 7/16 right, 3/16, 5/16, 1/16 below */
+                double v = vals[x] + err[x + 1];
+                l = q.nearest[to_byte(v)];
+                double e = v - q.value[l];
+                err[x + 2] += e * (7.0 / 16.0);
+                next[x] += e * (3.0 / 16.0);
+                next[x + 1] += e * (5.0 / 16.0);
+                next[x + 2] += e * (1.0 / 16.0);
+            } else {
+                l = q.nearest[to_byte(vals[x])];
+            }
+            size_t bit = (size_t)x * bit_depth;
+            raw[1 + bit / 8] |= (unsigned char)(l << (8 - bit_depth - bit % 8));
+        }
+        if (dither) {
+            double *t = err; err = next; next = t;
+            memset(next, 0, (width + 2) * sizeof(double));
+        }
+        strm.next_in = raw;
+        strm.avail_in = (uInt)(row_bytes + 1);
+        int flush = (y == height - 1) ? Z_FINISH : Z_NO_FLUSH;
+        do {
+            if (cmp_len == cmp_cap) {
+                cmp_cap *= 2;
+                cmp = (unsigned char *)realloc(cmp, cmp_cap);
+            }
+            strm.next_out = cmp + cmp_len;
+            strm.avail_out = (uInt)(cmp_cap - cmp_len);
+            zret = deflate(&strm, flush);
+            cmp_len = cmp_cap - strm.avail_out;
+        } while (strm.avail_out == 0 || (flush == Z_FINISH && zret != Z_STREAM_END));
     }
+    deflateEnd(&strm);
+    free(err);
+    free(next);
 
-    if (write_chunk(f, "IDAT", cmp, (int)cmp_bound) != 0) {
+    if (write_chunk(f, "IDAT", cmp, (int)cmp_len) != 0) {
         fprintf(stderr, "savepng: failed writing IDAT\n");
-        free(cmp); free(raw); fclose(f);
-        return;
+        free(cmp); free(vals); free(raw); fclose(f);
+        return -1;
     }
 
     /* IEND */
+    int status = 0;
     if (write_chunk(f, "IEND", NULL, 0) != 0) {
         fprintf(stderr, "savepng: failed writing IEND\n");
+        status = -1;
     }
 
     free(cmp);
+    free(vals);
     free(raw);
-    fclose(f);
-}
\ No newline at end of file
+    if (fclose(f) != 0) status = -1;
+    return status;
+}
+
+int savepng_rows(const char *filename, int ihdr[7], png_fill_fn fill, void *ctx) {
+    return savepng_rows_dither(filename, ihdr, fill, ctx, 0);
+}
+
+/* Samples decoded at another bit depth are rescaled to 0..255 on the way
+   through to the caller's fill */
+struct scaled_rows {
+    png_fill_fn fill;
+    void *ctx;
+    double scale;
+    int width;
+};
+
+static void scale_row(int y, double *row, void *ctx) {
+    struct scaled_rows *s = (struct scaled_rows *)ctx;
+    s->fill(y, row, s->ctx);
+    for (int x = 0; x < s->width; ++x) row[x] *= s->scale;
+}
+
+int savepng_rows_from(const char *filename, int in_depth, int ihdr[7],
+                      png_fill_fn fill, void *ctx, int dither) {
+    if (!ihdr || in_depth < 1 || in_depth > 16) return -1;
+    if (in_depth == 8) return savepng_rows_dither(filename, ihdr, fill, ctx, dither);
+    struct scaled_rows s = {fill, ctx, 255.0 / ((1 << in_depth) - 1), ihdr[0]};
+    return savepng_rows_dither(filename, ihdr, scale_row, &s, dither);
+}
+
+/* savepng() reads the rows straight out of a height x width array */
+struct image_rows {
+    double **image;
+    int width;
+};
+
+static void copy_row(int y, double *row, void *ctx) {
+    struct image_rows *img = (struct image_rows *)ctx;
+    memcpy(row, img->image[y], sizeof(double) * img->width);
+}
+
+int savepng_from(const char *filename, double **image, int in_depth, int ihdr[7],
+                 int dither) {
+    if (!filename || !image || !ihdr) return -1;
+    struct image_rows img = {image, ihdr[0]};
+    return savepng_rows_from(filename, in_depth, ihdr, copy_row, &img, dither);
+}
+
+void savepng(const char *filename, double **image, int ihdr[7]) {
+    savepng_from(filename, image, 8, ihdr, 0);
+}
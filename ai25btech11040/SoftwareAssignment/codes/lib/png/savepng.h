@@ -1,6 +1,32 @@
 #ifndef SAVEPNG_H
 #define SAVEPNG_H
 
+/* Fills row (width values, clamped to 0..255 on output) with scanline y */
+typedef void (*png_fill_fn)(int y, double *row, void *ctx);
+
+/* The output format is ihdr[2] (bit depth 1, 2, 4 or 8) and ihdr[3] (color
+   type): 0 writes grayscale, whose 2^depth levels are spread evenly over
+   0..255; 3 writes indices into a palette of at most 2^depth greys, the
+   levels of least squared error over the histogram of the image. A palette
+   takes one extra pass of fill over the rows to collect the histogram.
+   Nonzero dither diffuses each pixel's rounding error into its neighbours
+   (Floyd-Steinberg). Returns 0 on success, -1 on failure */
+int savepng_rows_dither(const char *filename, int ihdr[7], png_fill_fn fill,
+                        void *ctx, int dither);
+
+/* savepng_rows_dither() without dithering */
+int savepng_rows(const char *filename, int ihdr[7], png_fill_fn fill, void *ctx);
+
+/* For samples as readpng() decodes them, 0..2^in_depth - 1, rescaled to
+   0..255 before writing. ihdr is the output header: pass the decoded one
+   on only if its depth and color type are to be kept */
+int savepng_rows_from(const char *filename, int in_depth, int ihdr[7],
+                      png_fill_fn fill, void *ctx, int dither);
+
+int savepng_from(const char *filename, double **image, int in_depth, int ihdr[7],
+                 int dither);
+
+/* image in 0..255 */
 void savepng(const char *filename, double **image, int ihdr[7]);
 
 #endif // SAVEPNG_H
\ No newline at end of file
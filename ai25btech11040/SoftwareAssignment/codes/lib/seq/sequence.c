@@ -0,0 +1,171 @@
+// Compressing a sequence of frames (video, time-lapse), reusing each frame's
+// factorization as the starting point for the next one
+
+#include "sequence.h"
+#include "../matrix/helper.h"
+#include "../matrix/lra.h"
+#include "../matrix/svd.h"
+#include "../png/readpng.h"
+#include "../png/savepng.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int cmp_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int file_exists(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return 0;
+  fclose(f);
+  return 1;
+}
+
+// A frame pattern is used as a printf format, so it must hold exactly one
+// %d or %0Nd and no other '%'
+static int valid_pattern(const char *src) {
+  int conversions = 0;
+  for (const char *p = strchr(src, '%'); p; p = strchr(p, '%')) {
+    p++;
+    if (*p == '0')
+      while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p != 'd')
+      return 0;
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+// List the frames: every .png in a directory (sorted by name), or a printf
+// style pattern such as frames/f%04d.png numbered from 0 or 1 until the first
+// missing file. Returns the number of frames, paths in *out.
+static int list_frames(const char *src, char ***out) {
+  int cnt = 0, cap = 16;
+  char **names = (char **)malloc(cap * sizeof(char *));
+  DIR *dir = opendir(src);
+  if (dir) {
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+      size_t len = strlen(ent->d_name);
+      if (len < 4 || strcmp(ent->d_name + len - 4, ".png") != 0)
+        continue;
+      if (cnt == cap) {
+        cap *= 2;
+        names = (char **)realloc(names, cap * sizeof(char *));
+      }
+      names[cnt] = (char *)malloc(strlen(src) + len + 2);
+      sprintf(names[cnt], "%s/%s", src, ent->d_name);
+      cnt++;
+    }
+    closedir(dir);
+    qsort(names, cnt, sizeof(char *), cmp_names);
+  } else if (strchr(src, '%')) {
+    if (!valid_pattern(src)) {
+      fprintf(stderr, "Frame pattern %s must hold one %%d or %%0Nd and no "
+                      "other '%%'\n", src);
+      *out = names;
+      return 0;
+    }
+    char path[4096];
+    int start = 0;
+    snprintf(path, sizeof(path), src, 0);
+    if (!file_exists(path))
+      start = 1;
+    for (int i = start;; i++) {
+      snprintf(path, sizeof(path), src, i);
+      if (!file_exists(path))
+        break;
+      if (cnt == cap) {
+        cap *= 2;
+        names = (char **)realloc(names, cap * sizeof(char *));
+      }
+      names[cnt++] = strdup(path);
+    }
+  }
+  *out = names;
+  return cnt;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int run_sequence(const char *src, int k, double grey) {
+  char **frames;
+  int count = list_frames(src, &frames);
+  if (count == 0) {
+    fprintf(stderr, "No frames found in %s\n", src);
+    free(frames);
+    return -1;
+  }
+
+  thin_svd *prev = NULL; // factorization of the previous frame
+  int cold = 0, warm = 0;
+  double cold_ms = 0.0, warm_ms = 0.0;
+  for (int f = 0; f < count; f++) {
+    double t0 = now_ms();
+    int ihdr[7];
+    int **array = readpng(frames[f], ihdr);
+    if (!array) {
+      fprintf(stderr, "Failed to read PNG file %s\n", frames[f]);
+      free(frames[f]);
+      continue;
+    }
+    int m = ihdr[1], n = ihdr[0];
+    double **A = (double **)malloc(m * sizeof(double *));
+    for (int i = 0; i < m; i++) {
+      A[i] = (double *)malloc(n * sizeof(double));
+      for (int j = 0; j < n; j++)
+        A[i][j] = (double)array[i][j];
+      free(array[i]);
+    }
+    free(array);
+
+    int used, iters;
+    thin_svd *s = svd_warm(m, n, A, k, grey, prev, &used, &iters);
+    free_thin_svd(prev);
+    prev = s;
+    double **A_k = low_rank_approx_thin(s, k);
+
+    char out[64];
+    snprintf(out, sizeof(out), "out_%04d.png", f);
+    int out_hdr[7] = {n, m, 8, 0, 0, 0, 0};
+    savepng_from(out, A_k, ihdr[2], out_hdr, 0);
+    double ms = now_ms() - t0;
+    printf("Frame %d (%s -> %s): %s, %.2f ms\n", f, frames[f], out,
+           used ? "warm start" : "cold start", ms);
+    printf("  %d %s\n", iters, used ? "subspace iterations" : "Jacobi rotations");
+    if (used) {
+      warm++;
+      warm_ms += ms;
+    } else {
+      cold++;
+      cold_ms += ms;
+    }
+
+    free_matrix(m, A_k);
+    free_matrix(m, A);
+    free(frames[f]);
+  }
+  free(frames);
+  free_thin_svd(prev);
+
+  printf("%d frames: %d cold", cold + warm, cold);
+  if (cold)
+    printf(" (%.2f ms each)", cold_ms / cold);
+  printf(", %d warm", warm);
+  if (warm)
+    printf(" (%.2f ms each)", warm_ms / warm);
+  if (cold && warm)
+    printf(", warm frames cost %.1f%% of a cold one",
+           100.0 * (warm_ms / warm) / (cold_ms / cold));
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+int run_sequence(const char *src, int k, double grey);
+
+#endif // SEQUENCE_H
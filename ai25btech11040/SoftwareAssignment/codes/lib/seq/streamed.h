@@ -0,0 +1,6 @@
+#ifndef STREAMED_H
+#define STREAMED_H
+
+int run_stream(const char *src, int k);
+
+#endif // STREAMED_H
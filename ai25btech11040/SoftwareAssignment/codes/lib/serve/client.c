@@ -0,0 +1,198 @@
+// Talking to the daemon: single requests, and a load test that keeps it busy
+// from several connections at once and reports latency percentiles
+
+#include "client.h"
+#include "daemon.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static int connect_to(const char *sock_path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror(sock_path);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Send one request line and read the one line answering it into reply
+static int request(int fd, const char *line, char *reply) {
+  size_t len = strlen(line), done = 0;
+  while (done < len) {
+    ssize_t put = write(fd, line + done, len - done);
+    if (put <= 0)
+      return -1;
+    done += put;
+  }
+  size_t got = 0;
+  while (got < DAEMON_LINE - 1) {
+    ssize_t r = read(fd, reply + got, 1);
+    if (r <= 0)
+      return -1;
+    if (reply[got++] == '\n')
+      break;
+  }
+  reply[got] = '\0';
+  return 0;
+}
+
+int run_client(const char *sock_path, const char *req) {
+  char line[DAEMON_LINE], reply[DAEMON_LINE];
+  if (snprintf(line, sizeof(line), "%s\n", req) >= (int)sizeof(line)) {
+    fprintf(stderr, "Request too long (over %d bytes)\n", DAEMON_LINE - 2);
+    return -1;
+  }
+  int fd = connect_to(sock_path);
+  if (fd < 0)
+    return -1;
+  int status = request(fd, line, reply);
+  close(fd);
+  if (status != 0)
+    return -1;
+  printf("%s", reply);
+  return strncmp(reply, "ok", 2) == 0 ? 0 : -1;
+}
+
+// The daemon runs in its own directory, so paths are sent absolute
+static void absolute(const char *path, char *out) {
+  if (path[0] == '/' || !getcwd(out, PATH_MAX))
+    snprintf(out, PATH_MAX, "%s", path);
+  else
+    snprintf(out + strlen(out), PATH_MAX - strlen(out), "/%s", path);
+}
+
+int run_compress(const char *sock_path, const char *in, const char *spec,
+                 const char *out) {
+  char ain[PATH_MAX], aout[PATH_MAX], req[DAEMON_LINE];
+  absolute(in, ain);
+  absolute(out, aout);
+  if (snprintf(req, sizeof(req), "compress\t%s\t%s\t%s", ain, aout, spec) >=
+      (int)sizeof(req)) {
+    fprintf(stderr, "Request too long (over %d bytes)\n", DAEMON_LINE - 2);
+    return -1;
+  }
+  return run_client(sock_path, req);
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+struct worker {
+  const char *sock_path;
+  int nimages;
+  char (*images)[PATH_MAX];
+  int first, count; // requests first .. first + count - 1
+  double *latency;  // per request, ms
+  int hits, failed;
+};
+
+// A request mixes an image and a k the way a preview-then-full-quality
+// service would: a few images, each asked for at several ranks
+static const int ranks[] = {5, 10, 20, 40, 80};
+
+static void *work(void *arg) {
+  struct worker *w = arg;
+  int fd = connect_to(w->sock_path);
+  char req[DAEMON_LINE], reply[DAEMON_LINE];
+  unsigned long seed = 12345 + w->first;
+  for (int i = 0; i < w->count; i++) {
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    int img = (seed >> 33) % w->nimages;
+    int k = ranks[(seed >> 20) % 5];
+    snprintf(req, sizeof(req), "compress\t%s\t/dev/null\t%d\n",
+             w->images[img], k);
+    double t0 = now_ms();
+    if (fd < 0 || request(fd, req, reply) != 0 ||
+        strncmp(reply, "ok", 2) != 0) {
+      w->failed++;
+      w->latency[w->first + i] = -1.0;
+      continue;
+    }
+    w->latency[w->first + i] = now_ms() - t0;
+    if (strstr(reply, "cached=1"))
+      w->hits++;
+  }
+  if (fd >= 0)
+    close(fd);
+  return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+int run_loadtest(const char *sock_path, int requests, int concurrency,
+                 int nimages, const char **images) {
+  if (requests <= 0 || concurrency <= 0 || nimages <= 0)
+    return -1;
+  if (concurrency > requests)
+    concurrency = requests;
+  char (*paths)[PATH_MAX] = malloc(nimages * sizeof(*paths));
+  for (int i = 0; i < nimages; i++)
+    absolute(images[i], paths[i]);
+  double *latency = (double *)malloc(requests * sizeof(double));
+  struct worker *w = (struct worker *)calloc(concurrency, sizeof(*w));
+  pthread_t *th = (pthread_t *)malloc(concurrency * sizeof(pthread_t));
+
+  double t0 = now_ms();
+  for (int c = 0, first = 0; c < concurrency; c++) {
+    w[c].sock_path = sock_path;
+    w[c].nimages = nimages;
+    w[c].images = paths;
+    w[c].first = first;
+    w[c].count = requests / concurrency + (c < requests % concurrency);
+    w[c].latency = latency;
+    first += w[c].count;
+    pthread_create(&th[c], NULL, work, &w[c]);
+  }
+  int hits = 0, failed = 0;
+  for (int c = 0; c < concurrency; c++) {
+    pthread_join(th[c], NULL);
+    hits += w[c].hits;
+    failed += w[c].failed;
+  }
+  double total = now_ms() - t0;
+
+  // failed requests sort first (-1) and are left out of the percentiles
+  qsort(latency, requests, sizeof(double), cmp_double);
+  int ok = requests - failed;
+  printf("%d requests over %d connections in %.1f ms (%.1f requests/s), "
+         "%d failed\n",
+         requests, concurrency, total, requests * 1e3 / total, failed);
+  if (ok > 0) {
+    double *l = latency + failed, mean = 0.0;
+    for (int i = 0; i < ok; i++)
+      mean += l[i];
+    // nearest-rank percentiles
+    printf("Latency: p50 %.2f ms, p99 %.2f ms, mean %.2f ms, max %.2f ms\n",
+           l[(50 * ok + 99) / 100 - 1], l[(99 * ok + 99) / 100 - 1],
+           mean / ok, l[ok - 1]);
+    printf("Cache hits: %d of %d (%.1f%%)\n", hits, ok, 100.0 * hits / ok);
+  }
+  printf("Daemon: ");
+  fflush(stdout);
+  run_client(sock_path, "stats");
+
+  free(paths);
+  free(latency);
+  free(w);
+  free(th);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,12 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+int run_client(const char *sock_path, const char *request);
+
+int run_compress(const char *sock_path, const char *in, const char *spec,
+                 const char *out);
+
+int run_loadtest(const char *sock_path, int requests, int concurrency,
+                 int nimages, const char **images);
+
+#endif // CLIENT_H
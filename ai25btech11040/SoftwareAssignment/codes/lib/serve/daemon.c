@@ -0,0 +1,375 @@
+// Compression daemon: serves jobs over a Unix domain socket and keeps the
+// decoded matrices and their SVD factors in an LRU cache keyed by a hash of
+// the file contents, so that asking for the same image again (at any k or
+// target) only costs a reconstruction
+
+#include "daemon.h"
+#include "../matrix/helper.h"
+#include "../matrix/lra.h"
+#include "../matrix/rank.h"
+#include "../matrix/svd.h"
+#include "../png/readpng.h"
+#include "../png/savepng.h"
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct entry {
+  uint64_t hash;
+  int m, n, bit_depth;
+  double **A;  // decoded image, m x n
+  thin_svd *f; // every singular triplet of A
+  double fro2; // ||A||^2
+  size_t bytes;
+  int refs;    // jobs using the entry right now
+  int cached;  // still in the list (not evicted)
+  struct entry *prev, *next; // most recently used first
+} entry;
+
+static struct {
+  pthread_mutex_t lock;
+  entry *head, *tail;
+  size_t bytes, cap;
+  int entries;
+  long hits, misses, evictions;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int listen_fd = -1;
+
+// 64-bit FNV-1a of the whole file; returns -1 if it cannot be read
+static int hash_file(const char *path, uint64_t *out) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return -1;
+  uint64_t h = 1469598103934665603ULL;
+  unsigned char buf[65536];
+  size_t got;
+  while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+    for (size_t i = 0; i < got; i++) {
+      h ^= buf[i];
+      h *= 1099511628211ULL;
+    }
+  fclose(f);
+  *out = h;
+  return 0;
+}
+
+static void free_entry(entry *e) {
+  free_matrix(e->m, e->A);
+  free_thin_svd(e->f);
+  free(e);
+}
+
+static void unlink_entry(entry *e) {
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    cache.head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    cache.tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void push_front(entry *e) {
+  e->prev = NULL;
+  e->next = cache.head;
+  if (cache.head)
+    cache.head->prev = e;
+  cache.head = e;
+  if (!cache.tail)
+    cache.tail = e;
+}
+
+// Drop least recently used entries until we are under the cap. Entries in
+// use are skipped; whoever releases them last frees them. Called locked.
+static void evict(void) {
+  entry *e = cache.tail;
+  while (e && cache.bytes > cache.cap) {
+    entry *prev = e->prev;
+    if (e->refs == 0) {
+      unlink_entry(e);
+      e->cached = 0;
+      cache.bytes -= e->bytes;
+      cache.entries--;
+      cache.evictions++;
+      free_entry(e);
+    }
+    e = prev;
+  }
+}
+
+static entry *lookup(uint64_t hash) {
+  for (entry *e = cache.head; e; e = e->next)
+    if (e->hash == hash)
+      return e;
+  return NULL;
+}
+
+static void release(entry *e) {
+  pthread_mutex_lock(&cache.lock);
+  e->refs--;
+  if (e->refs == 0 && !e->cached)
+    free_entry(e);
+  else
+    evict(); // it may have been kept over the cap while in use
+  pthread_mutex_unlock(&cache.lock);
+}
+
+struct decode {
+  const int *ihdr;
+  double **A;
+};
+
+static void decode_row(int y, const int *row, void *ctx) {
+  struct decode *d = ctx;
+  int n = d->ihdr[0];
+  if (d->A == NULL)
+    d->A = (double **)calloc(d->ihdr[1], sizeof(double *));
+  d->A[y] = (double *)malloc(n * sizeof(double));
+  for (int j = 0; j < n; j++)
+    d->A[y][j] = (double)row[j];
+}
+
+// Decode and factor on a miss. The slow part runs unlocked, so two clients
+// asking for the same new image at once may both compute it; the second one
+// to finish uses the first one's entry, and counts as a hit.
+static entry *acquire(const char *path, int *hit) {
+  uint64_t hash;
+  if (hash_file(path, &hash) != 0)
+    return NULL;
+
+  pthread_mutex_lock(&cache.lock);
+  entry *e = lookup(hash);
+  if (e) {
+    e->refs++;
+    unlink_entry(e);
+    push_front(e);
+    cache.hits++;
+    pthread_mutex_unlock(&cache.lock);
+    *hit = 1;
+    return e;
+  }
+  cache.misses++;
+  pthread_mutex_unlock(&cache.lock);
+  *hit = 0;
+
+  int ihdr[7];
+  struct decode d = {ihdr, NULL};
+  if (readpng_stream(path, ihdr, decode_row, &d, 0) != 0) {
+    if (d.A)
+      free_matrix(ihdr[1], d.A);
+    return NULL;
+  }
+  e = (entry *)calloc(1, sizeof(entry));
+  e->hash = hash;
+  e->m = ihdr[1];
+  e->n = ihdr[0];
+  e->bit_depth = ihdr[2];
+  e->A = d.A;
+  e->f = svd_thin(e->m, e->n, e->A, 0, 0.0, NULL);
+  for (int i = 0; i < e->m; i++)
+    for (int j = 0; j < e->n; j++)
+      e->fro2 += e->A[i][j] * e->A[i][j];
+  e->bytes = sizeof(entry) +
+             ((size_t)e->m * e->n + (size_t)(e->m + e->n + 1) * e->f->r) *
+                 sizeof(double);
+  e->refs = 1;
+
+  pthread_mutex_lock(&cache.lock);
+  entry *other = lookup(hash);
+  if (other) {
+    // another thread inserted it first: served from the cache after all
+    other->refs++;
+    cache.misses--;
+    cache.hits++;
+    pthread_mutex_unlock(&cache.lock);
+    free_entry(e);
+    *hit = 1;
+    return other;
+  }
+  if (e->bytes <= cache.cap) {
+    push_front(e);
+    e->cached = 1;
+    cache.bytes += e->bytes;
+    cache.entries++;
+    evict();
+  }
+  pthread_mutex_unlock(&cache.lock);
+  return e;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static const char *spec_names[] = {"psnr=", "error=", "energy=", "ratio="};
+
+static void do_compress(char *in, char *out, char *spec, char *reply) {
+  double t0 = now_ms();
+  int mode = -1, k = 0;
+  double target = 0.0;
+  for (int j = 0; j < 4; j++)
+    if (strncmp(spec, spec_names[j], strlen(spec_names[j])) == 0 &&
+        sscanf(spec + strlen(spec_names[j]), "%lf", &target) == 1)
+      mode = j;
+  if (mode < 0 && (sscanf(spec, "%d", &k) != 1 || k <= 0)) {
+    snprintf(reply, DAEMON_LINE, "error bad k or target '%s'\n", spec);
+    return;
+  }
+
+  int hit;
+  entry *e = acquire(in, &hit);
+  if (!e) {
+    snprintf(reply, DAEMON_LINE, "error cannot read %s\n", in);
+    return;
+  }
+  int m = e->m, n = e->n, maxval = (1 << e->bit_depth) - 1;
+  if (mode >= 0)
+    k = pick_rank(mode, m, n, e->f->r, e->f->S, e->fro2, target, maxval,
+                  NULL);
+  if (k > e->f->r)
+    k = e->f->r;
+  double **A_k = low_rank_approx_thin(e->f, k);
+
+  // error of the saved image, as the CLI reports it
+  double err2 = 0.0;
+  for (int i = 0; i < m; i++)
+    for (int j = 0; j < n; j++) {
+      double d = e->A[i][j] - (int)A_k[i][j];
+      err2 += d * d;
+    }
+  int ihdr[7] = {n, m, 8, 0, 0, 0, 0};
+  savepng_from(out, A_k, e->bit_depth, ihdr, 0);
+  free_matrix(m, A_k);
+  release(e);
+
+  double psnr = err2 > 0.0 ? 10.0 * log10((double)maxval * maxval * m * n /
+                                          err2)
+                           : HUGE_VAL;
+  snprintf(reply, DAEMON_LINE,
+           "ok k=%d cached=%d ms=%.2f error=%.5f psnr=%.5f\n", k, hit,
+           now_ms() - t0, sqrt(err2), psnr);
+}
+
+static void do_stats(char *reply) {
+  pthread_mutex_lock(&cache.lock);
+  long total = cache.hits + cache.misses;
+  snprintf(reply, DAEMON_LINE,
+           "ok entries=%d bytes=%zu cap=%zu hits=%ld misses=%ld "
+           "evictions=%ld hit_rate=%.3f\n",
+           cache.entries, cache.bytes, cache.cap, cache.hits, cache.misses,
+           cache.evictions, total ? (double)cache.hits / total : 0.0);
+  pthread_mutex_unlock(&cache.lock);
+}
+
+// One connection, any number of requests on it
+static void *serve(void *arg) {
+  int fd = *(int *)arg;
+  free(arg);
+  char *line = (char *)malloc(DAEMON_LINE);
+  char *reply = (char *)malloc(DAEMON_LINE);
+  size_t len = 0;
+  for (;;) {
+    char *nl = memchr(line, '\n', len);
+    if (!nl) {
+      if (len == DAEMON_LINE)
+        break; // no newline in a full buffer
+      ssize_t got = read(fd, line + len, DAEMON_LINE - len);
+      if (got <= 0)
+        break;
+      len += got;
+      continue;
+    }
+    *nl = '\0';
+    char *fields[4] = {NULL};
+    int cnt = 0;
+    for (char *p = line; p && cnt < 4; cnt++) {
+      fields[cnt] = p;
+      p = strchr(p, '\t');
+      if (p)
+        *p++ = '\0';
+    }
+    if (strcmp(fields[0], "compress") == 0 && cnt == 4) {
+      do_compress(fields[1], fields[2], fields[3], reply);
+    } else if (strcmp(fields[0], "stats") == 0) {
+      do_stats(reply);
+    } else if (strcmp(fields[0], "quit") == 0) {
+      snprintf(reply, DAEMON_LINE, "ok bye\n");
+      shutdown(listen_fd, SHUT_RDWR); // makes accept() fail below
+    } else {
+      snprintf(reply, DAEMON_LINE, "error unknown request\n");
+    }
+    if (write(fd, reply, strlen(reply)) < 0)
+      break;
+    len -= (nl + 1 - line);
+    memmove(line, nl + 1, len);
+  }
+  free(line);
+  free(reply);
+  close(fd);
+  return NULL;
+}
+
+int run_daemon(const char *sock_path, size_t cache_bytes) {
+  struct sockaddr_un addr;
+  if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", sock_path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, sock_path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  unlink(sock_path); // left behind by a previous run
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd, 64) != 0) {
+    perror(sock_path);
+    close(listen_fd);
+    return -1;
+  }
+  cache.cap = cache_bytes;
+  printf("Listening on %s, cache limit %.1f MB\n", sock_path,
+         cache_bytes / 1048576.0);
+  fflush(stdout);
+
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0 && errno == EINTR)
+      continue;
+    if (fd < 0)
+      break;
+    int *arg = (int *)malloc(sizeof(int));
+    *arg = fd;
+    pthread_t th;
+    if (pthread_create(&th, NULL, serve, arg) != 0) {
+      close(fd);
+      free(arg);
+      continue;
+    }
+    pthread_detach(th);
+  }
+  close(listen_fd);
+  unlink(sock_path);
+
+  char reply[DAEMON_LINE];
+  do_stats(reply);
+  printf("Stopped, %s", reply + 3);
+  return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h>
+
+// Protocol on the Unix socket: one request per line, fields separated by
+// tabs, and one reply line per request.
+//
+//   compress <input.png> <output.png> <k>     reply "ok k=.. cached=0|1
+//   compress ... psnr=<dB> (or error=, energy=, ratio=)  ms=.. error=.."
+//   stats                                     reply "ok entries=.. bytes=.."
+//   quit                                      stops the daemon
+//
+// Failures are answered with "error <reason>". Paths should be absolute,
+// since the daemon does not share the client's working directory.
+
+#define DAEMON_LINE 8192 // longest request or reply line
+
+int run_daemon(const char *sock_path, size_t cache_bytes);
+
+#endif // DAEMON_H
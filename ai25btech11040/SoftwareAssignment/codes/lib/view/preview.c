@@ -0,0 +1,267 @@
+// Interactive preview of A_k in the terminal. The image is factored once, and
+// the singular vectors are averaged down to the display grid: if the display
+// cell (r, c) covers the block R x C of the image, the mean of A_k over it is
+//   sum_t sigma_t mean_{i in R}(u_t[i]) mean_{j in C}(v_t[j])
+// so the view is itself a sum of rank-1 terms of display size. Changing k by
+// one adds or removes one of them, O(h w) for an h x w view, however large
+// the image. The error needs no pixels at all: ||A - A_k||_F^2 is ||A||_F^2
+// minus the sum of the k largest sigma_t^2.
+
+#include "preview.h"
+#include "../matrix/helper.h"
+#include "../matrix/lra.h"
+#include "../matrix/pyramid.h"
+#include "../png/readpng.h"
+#include "../png/savepng.h"
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PREVIEW_RANK 128 // triplets factored, unless k asks for more
+#define PREVIEW_ITERS 3  // svd_pyramid() iterations per level
+
+struct view {
+  int h, w, k, kmax;
+  double **ut;  // kmax x h: sigma_t times the row averages of u_t
+  double **vt;  // kmax x w: column averages of v_t
+  double *D;    // h x w view of A_k
+  double *tail; // tail[t] = ||A||_F^2 - sum_{s < t} sigma_s^2
+  double maxval, pixels;
+  char *out;    // frame buffer, written with a single fwrite()
+};
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// D += sign * (term t)
+static void add_term(struct view *v, int t, double sign) {
+  for (int r = 0; r < v->h; r++) {
+    double a = sign * v->ut[t][r];
+    double *row = v->D + (size_t)r * v->w;
+    for (int c = 0; c < v->w; c++)
+      row[c] += a * v->vt[t][c];
+  }
+}
+
+// Draws the view; the time shown runs from t0 (the keypress) to the frame
+// being ready to write
+static void render(struct view *v, double t0) {
+  char *p = v->out;
+  p += sprintf(p, "\x1B[H");
+  for (int r = 0; r < v->h; r++) {
+    int last = -1;
+    for (int c = 0; c < v->w; c++) {
+      double x = v->D[(size_t)r * v->w + c];
+      x = (x < 0) ? 0 : (x > v->maxval ? v->maxval : x);
+      int g = 232 + (int)(x * 23 / v->maxval + 0.5);
+      if (g != last)
+        p += sprintf(p, "\x1B[48;5;%dm", g);
+      last = g;
+      *p++ = ' ';
+      *p++ = ' ';
+    }
+    p += sprintf(p, "\x1B[0m\r\n");
+  }
+  double err = sqrt(v->tail[v->k] > 0 ? v->tail[v->k] : 0.0);
+  double ms = now_ms() - t0;
+  p += sprintf(p,
+               "\x1B[Kk = %d / %d  ||A - A_k||_F = %.2f  PSNR = %.2f dB  "
+               "(%.3f ms)  Up/Down: k +-1  Right/Left: k +-10  s: save  q: "
+               "quit\r\n",
+               v->k, v->kmax, err,
+               10.0 * log10(v->maxval * v->maxval * v->pixels / (err * err)),
+               ms);
+  fwrite(v->out, 1, p - v->out, stdout);
+  fflush(stdout);
+}
+
+// Terminal state to put back on every way out, signals included
+static struct termios saved_term;
+static int saved_tty;
+
+static void restore_terminal(void) {
+  static const char reset[] = "\x1B[0m\x1B[?25h";
+  ssize_t w = write(STDOUT_FILENO, reset, sizeof(reset) - 1);
+  (void)w;
+  if (saved_tty)
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_term);
+}
+
+// SIGINT/SIGTERM from elsewhere (Ctrl-C itself is read as a key in raw
+// mode): restore the terminal, then die of the signal as before
+static void on_signal(int sig) {
+  restore_terminal();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+// Next key: 'u', 'd', 'r', 'l' for the arrows, the character itself
+// otherwise, 'q' at the end of input
+static int read_key(void) {
+  unsigned char c;
+  if (read(STDIN_FILENO, &c, 1) != 1)
+    return 'q';
+  if (c != 0x1B)
+    return c;
+  unsigned char seq[2];
+  if (read(STDIN_FILENO, &seq[0], 1) != 1 || seq[0] != '[' ||
+      read(STDIN_FILENO, &seq[1], 1) != 1)
+    return 0;
+  switch (seq[1]) {
+  case 'A':
+    return 'u';
+  case 'B':
+    return 'd';
+  case 'C':
+    return 'r';
+  case 'D':
+    return 'l';
+  }
+  return 0;
+}
+
+int run_preview(const char *src, int k) {
+  int ihdr[7];
+  int **array = readpng(src, ihdr);
+  if (!array) {
+    fprintf(stderr, "Failed to read PNG file %s\n", src);
+    return -1;
+  }
+  int m = ihdr[1], n = ihdr[0];
+  double **A = (double **)malloc(m * sizeof(double *));
+  double total = 0.0;
+  for (int i = 0; i < m; i++) {
+    A[i] = (double *)malloc(n * sizeof(double));
+    for (int j = 0; j < n; j++) {
+      A[i][j] = (double)array[i][j];
+      total += A[i][j] * A[i][j];
+    }
+    free(array[i]);
+  }
+  free(array);
+
+  int r = (m < n) ? m : n;
+  int rank = (2 * k > PREVIEW_RANK) ? 2 * k : PREVIEW_RANK;
+  if (rank > r)
+    rank = r;
+  int levels;
+  double t0 = now_ms();
+  thin_svd *s = svd_pyramid(m, n, A, rank, PREVIEW_ITERS, &levels);
+  printf("Factored %d x %d at rank %d in %.2f ms (%d pyramid levels)\n", m, n,
+         rank, now_ms() - t0, levels);
+  free_matrix(m, A);
+
+  // display grid: two columns per cell, one line for the status
+  struct winsize ws;
+  int cols = 80, lines = 24;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col && ws.ws_row) {
+    cols = ws.ws_col;
+    lines = ws.ws_row;
+  }
+  double f = 1.0;
+  if ((double)m / (lines - 1) > f)
+    f = (double)m / (lines - 1);
+  if ((double)n / (cols / 2) > f)
+    f = (double)n / (cols / 2);
+  struct view v;
+  v.h = (int)(m / f) > 0 ? (int)(m / f) : 1;
+  v.w = (int)(n / f) > 0 ? (int)(n / f) : 1;
+  v.kmax = (s->r < rank) ? s->r : rank;
+  v.k = (k < v.kmax) ? k : v.kmax;
+  v.maxval = (1 << ihdr[2]) - 1;
+  v.pixels = (double)m * n;
+
+  v.ut = (double **)malloc(v.kmax * sizeof(double *));
+  v.vt = (double **)malloc(v.kmax * sizeof(double *));
+  v.tail = (double *)malloc((v.kmax + 1) * sizeof(double));
+  v.tail[0] = total;
+  for (int t = 0; t < v.kmax; t++) {
+    v.ut[t] = (double *)calloc(v.h, sizeof(double));
+    v.vt[t] = (double *)calloc(v.w, sizeof(double));
+    for (int y = 0; y < v.h; y++) {
+      int lo = (int)((long)y * m / v.h), hi = (int)((long)(y + 1) * m / v.h);
+      for (int i = lo; i < hi; i++)
+        v.ut[t][y] += s->U[i][t];
+      v.ut[t][y] *= s->S[t] / (hi - lo);
+    }
+    for (int x = 0; x < v.w; x++) {
+      int lo = (int)((long)x * n / v.w), hi = (int)((long)(x + 1) * n / v.w);
+      for (int j = lo; j < hi; j++)
+        v.vt[t][x] += s->V[j][t];
+      v.vt[t][x] /= hi - lo;
+    }
+    v.tail[t + 1] = v.tail[t] - s->S[t] * s->S[t];
+  }
+  v.D = (double *)calloc((size_t)v.h * v.w, sizeof(double));
+  for (int t = 0; t < v.k; t++)
+    add_term(&v, t, 1.0);
+  // at most 14 bytes per cell, plus each line's reset and the status
+  v.out = (char *)malloc((size_t)v.h * (14 * v.w + 8) + 256);
+
+  struct termios raw;
+  saved_tty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved_term) == 0;
+  void (*old_int)(int) = signal(SIGINT, on_signal);
+  void (*old_term)(int) = signal(SIGTERM, on_signal);
+  if (saved_tty) {
+    raw = saved_term;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG); // Ctrl-C arrives as a key
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+  }
+  printf("\x1B[2J\x1B[?25l");
+  render(&v, now_ms());
+  for (;;) {
+    int key = read_key();
+    if (key == 'q' || key == 3) // q or Ctrl-C
+      break;
+    int target = v.k;
+    if (key == 'u')
+      target = v.k + 1;
+    else if (key == 'd')
+      target = v.k - 1;
+    else if (key == 'r')
+      target = v.k + 10;
+    else if (key == 'l')
+      target = v.k - 10;
+    else if (key == 's') {
+      double **A_k = low_rank_approx_thin(s, v.k);
+      int out[7] = {n, m, 8, 0, 0, 0, 0};
+      savepng_from("out.png", A_k, ihdr[2], out, 0);
+      free_matrix(m, A_k);
+    }
+    if (target < 1)
+      target = 1;
+    if (target > v.kmax)
+      target = v.kmax;
+    if (target == v.k && key != 's')
+      continue;
+    t0 = now_ms();
+    for (; v.k < target; v.k++)
+      add_term(&v, v.k, 1.0);
+    for (; v.k > target; v.k--)
+      add_term(&v, v.k - 1, -1.0);
+    render(&v, t0);
+  }
+  fflush(stdout);
+  restore_terminal();
+  signal(SIGINT, old_int);
+  signal(SIGTERM, old_term);
+
+  free_matrix(v.kmax, v.ut);
+  free_matrix(v.kmax, v.vt);
+  free(v.tail);
+  free(v.D);
+  free(v.out);
+  free_thin_svd(s);
+  return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+// Interactive terminal preview: factors src once, then shows A_k scaled down
+// to the terminal in ANSI 256-colour grey blocks. Up/Down change k by one,
+// Right/Left by ten, s writes the current A_k to out.png and q or Ctrl-C
+// quits. When stdin is not a terminal the same keys are read from it
+// unbuffered, so the preview can be scripted.
+int run_preview(const char *src, int k);
+
+#endif // PREVIEW_H
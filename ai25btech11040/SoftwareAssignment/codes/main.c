@@ -1,15 +1,227 @@
+#include "lib/dist/mpisvd.h"
+#include "lib/matrix/batched.h"
 #include "lib/matrix/lra.h"
+#include "lib/matrix/pyramid.h"
+#include "lib/matrix/rank.h"
 #include "lib/matrix/svd.h"
+#include "lib/matrix/tsqr.h"
 #include "lib/png/readpng.h"
 #include "lib/png/savepng.h"
 #include "lib/matrix/helper.h"
+#include "lib/seq/sequence.h"
+#include "lib/seq/streamed.h"
+#include "lib/serve/client.h"
+#include "lib/serve/daemon.h"
+#include "lib/view/preview.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static const char *target_names[] = {"PSNR (dB)", "Frobenius error",
+                                     "energy fraction", "compression ratio"};
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s <input_image.png> <k> [options]\n"
+          "       %s <input_image.png> --target-<metric> <value> [options]\n"
+          "       %s --sequence <directory | pattern%%04d.png> <k> [options]\n"
+          "       %s --daemon <socket> [--cache-mb <MB>]\n"
+          "       %s --client <socket> <input_image.png> <k | --target-<metric> "
+          "<value>> [output.png]\n"
+          "       %s --client <socket> stats | quit\n"
+          "       %s --loadtest <socket> <requests> <connections> <image.png>...\n"
+          "Targets (k is chosen automatically):\n"
+          "  --target-psnr <dB>            PSNR of A_k at least <dB>\n"
+          "  --target-error <norm>         ||A - A_k|| at most <norm>\n"
+          "  --target-energy <fraction>    fraction of sum(sigma^2) kept\n"
+          "  --target-ratio <ratio>        m*n / (k*(m+n+1)) at least <ratio>\n"
+          "Options:\n"
+          "  --grey-tol <levels>           stop the solvers once no single\n"
+          "                                rotation can move a pixel by more\n"
+          "                                than <levels> (default, target and\n"
+          "                                sequence modes)\n"
+          "  --stream                      single pass: factor the rows while\n"
+          "                                they are decoded (fixed k only)\n"
+          "  --mpi                         distributed one-sided Jacobi, run\n"
+          "                                under mpirun (fixed k only)\n"
+          "  --gram auto|ata|aat           eigenproblem for a fixed k: A^T A,\n"
+          "                                A A^T or the smaller one (default)\n"
+          "  --pyramid <iterations>        coarse-to-fine SVD with <iterations>\n"
+          "                                subspace iterations per level,\n"
+          "                                timed against the direct solve\n"
+          "                                (fixed k only)\n"
+          "  --preview                     show A_k in the terminal, starting\n"
+          "                                at k; the arrow keys change k\n"
+          "  --tiles 8|16|32               rank k in every tile of this size,\n"
+          "                                all factored as one batch\n"
+          "  --depth 1|2|4|8               bits per pixel of out.png (default 8)\n"
+          "  --palette                     out.png indexes 2^depth greys fitted\n"
+          "                                to A_k instead of even grey levels\n"
+          "  --dither                      diffuse the rounding error of the\n"
+          "                                reduced depth (Floyd-Steinberg)\n"
+          "Sequence mode writes out_0000.png, out_0001.png, ... and starts\n"
+          "each frame's SVD from the previous frame's.\n"
+          "The daemon keeps decoded images and their factors cached (256 MB\n"
+          "by default), so repeat requests only pay for reconstruction.\n",
+          prog, prog, prog, prog, prog, prog, prog);
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Daemon, client and load test modes
+static int serve_modes(int argc, const char *argv[]) {
+  static const char *specs[] = {"psnr", "error", "energy", "ratio"};
+  if (strcmp(argv[1], "--daemon") == 0) {
+    double mb = 256.0;
+    if (argc == 5 && strcmp(argv[3], "--cache-mb") == 0)
+      sscanf(argv[4], "%lf", &mb);
+    else if (argc != 3)
+      return -2;
+    return run_daemon(argv[2], (size_t)(mb * 1024 * 1024));
+  }
+  if (strcmp(argv[1], "--client") == 0) {
+    if (argc == 4)
+      return run_client(argv[2], argv[3]);
+    char spec[64] = "";
+    int next = 4;
+    if (argc >= 6 && strncmp(argv[4], "--target-", 9) == 0) {
+      for (int j = 0; j < 4; j++)
+        if (strcmp(argv[4] + 9, specs[j]) == 0)
+          snprintf(spec, sizeof(spec), "%s=%s", specs[j], argv[5]);
+      next = 6;
+    } else if (argc >= 5) {
+      snprintf(spec, sizeof(spec), "%s", argv[4]);
+      next = 5;
+    } else {
+      return -2;
+    }
+    if (argc > next + 1)
+      return -2;
+    return run_compress(argv[2], argv[3], spec,
+                        argc > next ? argv[next] : "out.png");
+  }
+  if (strcmp(argv[1], "--loadtest") == 0) {
+    if (argc < 6)
+      return -2;
+    return run_loadtest(argv[2], atoi(argv[3]), atoi(argv[4]), argc - 5,
+                        argv + 5);
+  }
+  return -3; // not one of these modes
+}
 
 int main(int argc, const char *argv[]) {
   int ihdr[7];
-  int k;
-  sscanf(argv[2], "%d", &k);
+  if (argc >= 2) {
+    int ret = serve_modes(argc, argv);
+    if (ret == -2)
+      usage(argv[0]);
+    if (ret != -3)
+      return ret;
+  }
+  int k = 0;
+  int mode = -1; // one of TARGET_*, or -1 for a fixed k
+  double target = 0.0;
+  double grey = 0.0; // 0 keeps the strict default tolerance
+  static const char *targets[] = {"--target-psnr", "--target-error",
+                                  "--target-energy", "--target-ratio"};
+  const char *sequence = NULL;
+  int stream = 0;
+  int mpi = 0;
+  int pyramid = 0; // subspace iterations per level, 0 for no pyramid
+  int preview = 0;
+  int tiles = 0; // tile size, 0 for the whole image
+  int depth = 8; // bits per pixel of out.png
+  int palette = 0;
+  int dither = 0;
+  int gram = GRAM_AUTO;
+  static const char *grams[] = {"auto", "ata", "aat"};
+  int first = 2; // first argument after the input
+  if (argc >= 3 && strcmp(argv[1], "--sequence") == 0) {
+    sequence = argv[2];
+    first = 3;
+  }
+  if (argc < first + 1) {
+    usage(argv[0]);
+    return -1;
+  }
+  for (int a = first; a < argc; a++) {
+    int t = -1;
+    for (int j = 0; j < 4; j++)
+      if (strcmp(argv[a], targets[j]) == 0)
+        t = j;
+    if (t >= 0 && a + 1 < argc && sscanf(argv[a + 1], "%lf", &target) == 1 &&
+        (t != TARGET_RATIO || target > 0.0)) {
+      mode = t;
+      a++;
+    } else if (strcmp(argv[a], "--grey-tol") == 0 && a + 1 < argc &&
+               sscanf(argv[a + 1], "%lf", &grey) == 1) {
+      a++;
+    } else if (strcmp(argv[a], "--stream") == 0) {
+      stream = 1;
+    } else if (strcmp(argv[a], "--mpi") == 0) {
+      mpi = 1;
+    } else if (strcmp(argv[a], "--palette") == 0) {
+      palette = 1;
+    } else if (strcmp(argv[a], "--dither") == 0) {
+      dither = 1;
+    } else if (strcmp(argv[a], "--depth") == 0 && a + 1 < argc &&
+               sscanf(argv[a + 1], "%d", &depth) == 1 &&
+               (depth == 1 || depth == 2 || depth == 4 || depth == 8)) {
+      a++;
+    } else if (strcmp(argv[a], "--preview") == 0) {
+      preview = 1;
+    } else if (strcmp(argv[a], "--tiles") == 0 && a + 1 < argc &&
+               sscanf(argv[a + 1], "%d", &tiles) == 1 && tiles > 0) {
+      a++;
+    } else if (strcmp(argv[a], "--pyramid") == 0 && a + 1 < argc &&
+               sscanf(argv[a + 1], "%d", &pyramid) == 1 && pyramid > 0) {
+      a++;
+    } else if (strcmp(argv[a], "--gram") == 0 && a + 1 < argc) {
+      gram = -1;
+      for (int j = 0; j < 3; j++)
+        if (strcmp(argv[a + 1], grams[j]) == 0)
+          gram = j;
+      if (gram < 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      a++;
+    } else if (argv[a][0] == '-' || sscanf(argv[a], "%d", &k) != 1) {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if ((mode < 0 && k <= 0) || (sequence && mode >= 0) ||
+      ((stream || mpi || pyramid || preview || tiles) &&
+       (sequence || mode >= 0)) ||
+      (stream + mpi + (pyramid > 0) + preview + (tiles > 0) > 1) ||
+      ((depth != 8 || palette || dither) &&
+       (sequence || stream || mpi || pyramid || preview || tiles)) ||
+      (gram != GRAM_AUTO && (sequence || mode >= 0 || stream || mpi ||
+                             pyramid || preview || tiles)) ||
+      (grey > 0.0 && (stream || mpi || pyramid || preview || tiles))) {
+    usage(argv[0]);
+    return -1;
+  }
+  if (sequence)
+    return run_sequence(sequence, k, grey);
+  if (stream)
+    return run_stream(argv[1], k);
+  if (mpi)
+    return run_mpi(argv[1], k);
+  if (pyramid)
+    return run_pyramid(argv[1], k, pyramid);
+  if (preview)
+    return run_preview(argv[1], k);
+  if (tiles)
+    return run_tiles(argv[1], tiles, k);
   int **array = readpng(argv[1], ihdr);
   if (!array) {
     fprintf(stderr, "Failed to read PNG file %s\n", argv[1]);
@@ -23,8 +235,43 @@ int main(int argc, const char *argv[]) {
       double_array[i][j] = (double)array[i][j];
     }
   }
-  double ***svd_result = svd(ihdr[1], ihdr[0], double_array);
-  double **A_k = low_rank_approx(ihdr[1], ihdr[0], svd_result, k);
+  thin_svd *svd_result;
+  if (mode >= 0) {
+    double achieved;
+    int reached;
+    svd_result = svd_target(ihdr[1], ihdr[0], double_array, mode, target,
+                            (1 << ihdr[2]) - 1, grey, &k, &achieved, &reached);
+    if (!svd_result || !reached) {
+      if (!svd_result)
+        fprintf(stderr, "Invalid target %lf\n", target);
+      else
+        fprintf(stderr,
+                "Target %.5lf cannot be reached: %s of A_k is %.5lf at k = "
+                "%d\n",
+                target, target_names[mode], achieved, k);
+      for (int i = 0; i < ihdr[1]; i++)
+        free(array[i]);
+      free(array);
+      free_matrix(ihdr[1], double_array);
+      if (svd_result)
+        free_thin_svd(svd_result);
+      return -1;
+    }
+    printf("Selected k = %d, %s of A_k: %.5lf (target %.5lf)\n", k,
+           target_names[mode], achieved, target);
+  } else {
+    int rotations;
+    if (gram == GRAM_AUTO)
+      gram = (ihdr[1] < ihdr[0]) ? GRAM_AAT : GRAM_ATA;
+    svd_result = svd_thin_gram(ihdr[1], ihdr[0], double_array, k, grey, gram,
+                               &rotations);
+    int g = (gram == GRAM_AAT) ? ihdr[1] : ihdr[0];
+    printf("Jacobi rotations: %d (%s, %d x %d)\n", rotations,
+           gram == GRAM_AAT ? "A A^T" : "A^T A", g, g);
+  }
+  printf("||U^T U - I||_F: %.3e\n",
+         orthogonality(svd_result->m, svd_result->r, svd_result->U));
+  double **A_k = low_rank_approx_thin(svd_result, k);
   int **A_k_int = (int **)malloc(ihdr[1] * sizeof(int *));
   for (int i = 0; i < ihdr[1]; i++) {
     A_k_int[i] = (int *)malloc(ihdr[0] * sizeof(int));
@@ -45,22 +292,12 @@ int main(int argc, const char *argv[]) {
   printf("Frobenius norm of the difference between original and A_k: %.5lf\n",
          frob_norm);
   printf("Frobenius norm error per pixel: %.5lf\n", frob_norm / (ihdr[1] * ihdr[0]));
-
-  // free memory
-  for (int i = 0; i < ihdr[1]; i++) {
-    free(array[i]);
-    free(double_array[i]);
+  if (mode >= 0) {
+    double maxval = (1 << ihdr[2]) - 1;
+    printf("PSNR of the saved image: %.5lf dB\n",
+           10.0 * log10(maxval * maxval * ihdr[1] * ihdr[0] /
+                        (frob_norm * frob_norm)));
   }
-  free(array);
-  free(double_array);
-  for (int i = 0; i < ihdr[1]; i++) {
-    free(svd_result[0][i]);
-    free(svd_result[1][i]);
-  }
-  free(svd_result[0]);
-  free(svd_result[1]);
-  free(svd_result[2]);
-  free(svd_result);
 
   // DEBUG: print A_k in the block format in lib/png/readpng.c
   // for (int i = 0; i < ihdr[1]; i++) {
@@ -70,6 +307,29 @@ int main(int argc, const char *argv[]) {
   //   }
   //   printf("\n");
   // }
-  savepng("out.png", A_k, ihdr);
+  int out[7];
+  memcpy(out, ihdr, sizeof(out));
+  out[2] = depth;
+  out[3] = palette ? 3 : 0;
+  double t0 = now_ms();
+  savepng_from("out.png", A_k, ihdr[2], out, dither);
+  double ms = now_ms() - t0;
+  struct stat st;
+  if (stat("out.png", &st) == 0)
+    printf("out.png: %d-bit %s%s, %lld bytes, encoded in %.2f ms\n", depth,
+           palette ? "palette" : "greyscale", dither ? ", dithered" : "",
+           (long long)st.st_size, ms);
+
+  // free memory
+  for (int i = 0; i < ihdr[1]; i++) {
+    free(array[i]);
+    free(A_k_int[i]);
+  }
+  free(array);
+  free(A_k_int);
+  free_matrix(ihdr[1], double_array);
+  free_matrix(ihdr[1], diff_arr);
+  free_thin_svd(svd_result);
+  free_matrix(ihdr[1], A_k);
   return 0;
 }
\ No newline at end of file